@@ -0,0 +1,159 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// Fill throughput of VoxelAccumulator for the dense/sparse storages and the
+// planar/interleaved layouts.
+//
+// The hits mimic a pencil beam along z: every primary walks through the
+// 100x100x300 grid with a small lateral spread, depositing one hit per voxel,
+// and spawns short secondary tracks of other species around its path. Each hit
+// fills the four quantities, as DetectorMatrix::Fill does.
+//
+// Usage: fillbench [primaries] [species] [repetitions]
+
+// PDD1 Headers
+#include "VoxelAccumulator.hh"
+
+// C++ Headers
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+const G4int kNX = 100;
+const G4int kNY = 100;
+const G4int kNZ = 300;
+
+struct Hit
+{
+	G4int species;
+	G4int i, j, k;
+	G4double eDep, dx, dedx;
+};
+
+G4int Clamp(G4int value, G4int n)
+{
+	return value < 0 ? 0 : (value >= n ? n - 1 : value);
+}
+
+std::vector<Hit> GenerateHits(G4int nPrimaries, G4int nSpecies)
+{
+	std::mt19937 engine(12345);
+	std::normal_distribution<G4double> lateral(0., 4.);
+	std::uniform_real_distribution<G4double> uniform(0., 1.);
+	std::uniform_int_distribution<G4int> secondarySpecies(1, nSpecies > 1 ? nSpecies - 1 : 1);
+
+	std::vector<Hit> hits;
+	hits.reserve(size_t(nPrimaries) * kNZ * 2);
+
+	for (G4int p=0; p<nPrimaries; p++)
+	{
+		G4double x = kNX/2 + lateral(engine);
+		G4double y = kNY/2 + lateral(engine);
+		G4int range = kNZ - G4int(30 * uniform(engine));
+
+		for (G4int k=0; k<range; k++)
+		{
+			// Multiple scattering: the track drifts slowly away from the axis
+			x += 0.1 * lateral(engine);
+			y += 0.1 * lateral(engine);
+			G4int i = Clamp(G4int(x), kNX);
+			G4int j = Clamp(G4int(y), kNY);
+
+			Hit hit = { 0, i, j, k, uniform(engine), 1., 1. + uniform(engine) };
+			hits.push_back(hit);
+
+			// Short secondary track around the primary
+			if (nSpecies > 1 && uniform(engine) < 0.1)
+			{
+				G4int species = secondarySpecies(engine);
+				G4int length = 1 + G4int(5 * uniform(engine));
+				for (G4int s=0; s<length; s++)
+				{
+					Hit secondaryHit = { species, Clamp(i + s/2, kNX), j, Clamp(k + s, kNZ),
+							uniform(engine), 0.5, 10. * uniform(engine) };
+					hits.push_back(secondaryHit);
+				}
+			}
+		}
+	}
+
+	return hits;
+}
+
+void Run(const char* name, VoxelAccumulator::Storage storage, VoxelAccumulator::Layout layout,
+		const std::vector<Hit>& hits, G4int nSpecies, G4int nRepetitions)
+{
+	std::vector<VoxelAccumulator*> species;
+	for (G4int s=0; s<nSpecies; s++)
+		species.push_back(new VoxelAccumulator(kNX, kNY, kNZ, storage, layout));
+
+	G4double best = 0.;
+	for (G4int r=0; r<nRepetitions; r++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (size_t h=0; h<hits.size(); h++)
+		{
+			const Hit& hit = hits[h];
+			VoxelAccumulator* data = species[hit.species];
+			data->Add(VoxelAccumulator::kEDep, hit.i, hit.j, hit.k, hit.eDep);
+			data->Add(VoxelAccumulator::kLetN, hit.i, hit.j, hit.k, hit.eDep * hit.dedx);
+			data->Add(VoxelAccumulator::kLetD, hit.i, hit.j, hit.k, hit.eDep);
+			data->Add(VoxelAccumulator::kFluence, hit.i, hit.j, hit.k, hit.dx);
+		}
+
+		std::chrono::duration<G4double> elapsed = std::chrono::steady_clock::now() - start;
+		G4double rate = hits.size() / elapsed.count();
+		if (rate > best) best = rate;
+	}
+
+	size_t memory = 0;
+	for (G4int s=0; s<nSpecies; s++)
+	{
+		memory += species[s]->GetMemoryUsage();
+		delete species[s];
+	}
+
+	std::printf("%-20s %10.2f Mhits/s %10.1f MB\n", name, best * 1e-6, memory / 1048576.);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	G4int nPrimaries = argc > 1 ? std::atoi(argv[1]) : 20000;
+	G4int nSpecies = argc > 2 ? std::atoi(argv[2]) : 4;
+	G4int nRepetitions = argc > 3 ? std::atoi(argv[3]) : 3;
+
+	std::vector<Hit> hits = GenerateHits(nPrimaries, nSpecies);
+
+	std::printf("Grid %dx%dx%d, %d species, %zu hits, best of %d\n",
+			kNX, kNY, kNZ, nSpecies, hits.size(), nRepetitions);
+
+	Run("dense planar", VoxelAccumulator::kDense, VoxelAccumulator::kPlanar, hits, nSpecies, nRepetitions);
+	Run("dense interleaved", VoxelAccumulator::kDense, VoxelAccumulator::kInterleaved, hits, nSpecies, nRepetitions);
+	Run("sparse planar", VoxelAccumulator::kSparse, VoxelAccumulator::kPlanar, hits, nSpecies, nRepetitions);
+	Run("sparse interleaved", VoxelAccumulator::kSparse, VoxelAccumulator::kInterleaved, hits, nSpecies, nRepetitions);
+
+	return 0;
+}
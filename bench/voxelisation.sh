@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# PDD 1.0
+# Copyright (c) 2020
+# Universidad Nacional de Colombia
+# Servicio Geológico Colombiano
+# All Right Reserved.
+#
+# Developed by Andrés Camilo Sevilla Moreno
+#
+# Use and copying of these libraries and preparation of derivative works
+# based upon these libraries are permitted. Any copy of these libraries
+# must include this copyright notice.
+#
+# Bogotá, Colombia.
+#
+
+# Navigation cost of the nested (replicas + nested parameterisation), the
+# regular (G4PhantomParameterisation + G4RegularNavigation) and the none
+# (homogeneous detector, steps split by the scorer) voxelisations.
+#
+# Runs dose with the beam of run1.mac once per voxelisation and reports the
+# steps per event and the events per second of the event loop, read from the
+# run manifests, and both relative to nested. The table is also written to
+# voxelisation.txt with the setup, to be quoted with the results.
+#
+# Usage, from the build directory: bench/voxelisation.sh [events] [threads]
+
+EVENTS=${1:-1000}
+THREADS=${2:-1}
+SEED=12345
+
+for VOXELISATION in nested regular none
+do
+	MACRO=voxelisation-$VOXELISATION.mac
+	cat > $MACRO <<END
+/PDD1/geometry/voxelisation $VOXELISATION
+/PDD1/output/format raw
+/run/numberOfThreads $THREADS
+/run/initialize
+/control/verbose 0
+/run/verbose 0
+/run/setCut 1 mm
+/run/setCutForRegion Target 10 um
+/control/execute beam/elliptical-beam.mac
+/gps/pos/halfx 0 mm
+/gps/pos/halfy 0 mm
+/gps/particle proton
+/gps/ene/mono 131 MeV
+/run/beamOn $EVENTS
+END
+
+	./dose -m $MACRO -s $SEED > voxelisation-$VOXELISATION.log 2>&1 || { echo "dose failed, see voxelisation-$VOXELISATION.log"; exit 1; }
+	JOB=$(sed -n 's/^DetectorMatrix: the outputs of this job are written to //p' voxelisation-$VOXELISATION.log)
+	cp $JOB/run0/manifest.json voxelisation-$VOXELISATION.json
+	rm -f $MACRO
+done
+
+python3 - $EVENTS $THREADS $SEED <<'END' | tee voxelisation.txt
+import json
+import platform
+import sys
+
+events, threads, seed = sys.argv[1:4]
+print("%s events, %s threads, seed %s, %s" % (events, threads, seed, platform.processor() or platform.machine()))
+print("%-12s %12s %14s %12s %10s %10s" % ("voxelisation", "events", "steps/event", "events/s", "steps", "speed"))
+reference = None
+for voxelisation in ("nested", "regular", "none"):
+    with open("voxelisation-%s.json" % voxelisation) as f:
+        manifest = json.load(f)
+    events = manifest["events"]
+    wall = manifest["timing"]["event_loop"]["wall_s"]
+    steps, rate = manifest["steps"] / events, events / wall
+    if reference is None:
+        reference = (steps, rate)
+    print("%-12s %12d %14.1f %12.2f %9.2fx %9.2fx" % (voxelisation, events, steps, rate,
+            steps / reference[0], rate / reference[1]))
+END
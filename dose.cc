@@ -18,7 +18,8 @@
 // PPD1 Headers
 #include "PDD1DetectorConstruction.hh"
 #include "PDD1ActionInitialization.hh"
-#include "DetectorMatrix.hh"
+#include "OutputWriter.hh"
+#include "RunManifest.hh"
 
 // Geant4 Headers
 #include "G4RunManagerFactory.hh"
@@ -30,6 +31,10 @@
 #include "Randomize.hh"
 #include "G4ScoringManager.hh"
 
+// C++ Headers
+#include <cerrno>
+#include <cstdlib>
+
 namespace {
 void PrintUsage() {
 	G4cerr << " Usage: " << G4endl;
@@ -37,6 +42,7 @@ void PrintUsage() {
 			<< " [-vm vis_macro ]"
 			<< " [-ui user interface {'on','off'}]"
 			<< " [-n numberOfEvent ]"
+			<< " [-s seed ]"
 			<< "\n or\n ./dose [macro.mac]"
 			<< G4endl;
 }
@@ -49,7 +55,7 @@ int main(int argc,char** argv)
 	G4UIExecutive* ui = 0;
 
 	// Evaluate arguments
-	if ( argc > 9 ) {
+	if ( argc > 11 ) {
 		PrintUsage();
 		return 1;
 	}
@@ -58,6 +64,9 @@ int main(int argc,char** argv)
 	G4String vis_macro("");
 	G4String onOffUI("");
 	G4int numberOfEvent(0);
+	G4long seed = time( NULL );
+
+	RunManifest::Start();
 
 	if (argc == 1) {
 		ui = new G4UIExecutive(argc, argv);
@@ -78,6 +87,17 @@ int main(int argc,char** argv)
 				if(!ui) ui = new G4UIExecutive(argc, argv);
 			}
 			else if ( G4String(argv[i]) == "-n" ) numberOfEvent = G4UIcommand::ConvertToInt(argv[i+1]);
+			else if ( G4String(argv[i]) == "-s" ) {
+				// Full 64-bit seed, so the manifest records the one actually used
+				char* end = 0;
+				errno = 0;
+				seed = std::strtoll(argv[i+1], &end, 10);
+				if (errno == ERANGE || end == argv[i+1] || *end != '\0') {
+					G4cerr << " Invalid seed: " << argv[i+1] << G4endl;
+					PrintUsage();
+					return 1;
+				}
+			}
 			else{
 				PrintUsage();
 				return 1;
@@ -93,8 +113,8 @@ int main(int argc,char** argv)
 	//
 	CLHEP::RanluxEngine defaultEngine( 1234567, 4 );
 	G4Random::setTheEngine( &defaultEngine );
-	G4int seed = time( NULL );
 	G4Random::setTheSeed( seed );
+	RunManifest::seed = seed;
 
 	// Construct the default run manager
 	//
@@ -147,12 +167,8 @@ int main(int argc,char** argv)
 		delete ui;
 	}
 
-	if (DetectorMatrix* matrix = DetectorMatrix::GetInstance())
-	{
-		matrix -> StoreEDepAscii();
-		matrix -> StoreLetAscii();
-		matrix -> StoreFluenceAscii();
-	}
+	// Wait for the outputs of the last runs
+	OutputWriter::DeleteInstance();
 
 	// Job termination
 	// Free the store: user actions, physics_list and detector_description are
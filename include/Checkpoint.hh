@@ -0,0 +1,102 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef Checkpoint_h
+#define Checkpoint_h 1
+
+// PDD1 Headers
+#include "OutputWriter.hh"
+
+// Geant4 Headers
+#include "globals.hh"
+
+// C++ Headers
+#include <vector>
+
+class DetectorMatrix;
+
+// Periodic checkpoint and snapshots of the scoring matrix.
+//
+// Every everyEvents events and/or everyMinutes minutes the merged matrix, the
+// number of events of the run and the random engine state are written to
+// filename. The file is written next to it and renamed, so a job killed while
+// checkpointing leaves the previous checkpoint intact. In multi-threaded mode
+// each worker flushes its shard into the master between events; a worker
+// which finds the checkpoint lock taken keeps its events and retries later.
+// The checkpoint itself is written from a copy of the master by the
+// OutputWriter thread (at the cost of the memory of a second matrix). The
+// copy is queued after the lock is released, so only the worker which
+// triggers it waits, and only while the writer queue is full.
+//
+// The same flushing feeds the reduced snapshots written every
+// DetectorMatrix::snapshotEvery events (see DetectorMatrix::GetSnapshot).
+//
+// Resume() loads a checkpoint into the master matrix and returns the number
+// of events still to be simulated. In sequential mode the checkpoint holds
+// the engine state after its last event, and the resumed run continues the
+// interrupted one exactly. In multi-threaded mode the workers' engines cannot
+// be saved consistently: the checkpoint holds a seed derived from the master
+// state at the start of the run, and Resume() reseeds the master with it.
+// The resumed events are then new, independent events, so the result is only
+// statistically equivalent to an uninterrupted run. The resumed run's
+// manifest records the checkpoint, its events and the seed.
+
+class Checkpoint
+{
+public:
+
+  // Master: start counting towards the next checkpoint. Snapshots go to the
+  // output folder of the run
+  static void BeginOfRun(G4int runID, G4long eventsToProcess);
+
+  // Any thread, after the event has been scored
+  static void EndOfEvent(DetectorMatrix* matrix);
+
+  // Master: the run completed. Returns the checkpoint to remove once the run
+  // outputs have been stored (empty if checkpointing is off)
+  static G4String EndOfRun();
+
+  // Load a checkpoint into the master matrix and restore the random engine.
+  // Returns the events left to finish the checkpointed run, -1 on error
+  static G4long Resume(const G4String& file);
+
+public:
+
+  // Checkpoint every N events (0: off)
+  static G4long everyEvents;
+
+  // Checkpoint every T minutes (0: off)
+  static G4double everyMinutes;
+
+  // Checkpoint file
+  static G4String filename;
+
+private:
+
+  static G4bool Enabled() { return everyEvents > 0 || everyMinutes > 0.; }
+
+  // Writer thread: write a checkpoint of the events of the run
+  static void Write(const DetectorMatrix* matrix, const std::string& state,
+      G4long events, G4long seed, const G4String& file);
+
+  // Under the checkpoint lock: the writer jobs of the checkpoint and/or the
+  // snapshot which are due
+  static void WriteDue(DetectorMatrix* master, G4double now, std::vector<OutputWriter::Job>& jobs);
+};
+
+#endif // Checkpoint_h
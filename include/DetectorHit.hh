@@ -15,102 +15,67 @@
  *
  */
 
+
 #ifndef DetectorHit_h
 #define DetectorHit_h 1
 
 // Geant4 Headers
-#include "G4VHit.hh"
-#include "G4THitsCollection.hh"
-#include "G4Allocator.hh"
-#include "G4ThreeVector.hh"
-#include "G4ParticleDefinition.hh"
-#include "G4Material.hh"
-#include "tls.hh"
+#include "G4VHitsCollection.hh"
+#include "globals.hh"
 
-class DetectorHit : public G4VHit
-{
-  public:
-    DetectorHit();
-    DetectorHit(const DetectorHit&);
-    virtual ~DetectorHit();
+// C++ Headers
+#include <stdint.h>
+#include <vector>
 
-    // operators
-    const DetectorHit& operator=(const DetectorHit&);
-    G4bool operator==(const DetectorHit&) const;
+// Hit record of one step in the phantom.
+//
+// Plain data, 40 bytes: the voxel, species and material are stored as indices
+// (DetectorMatrix voxel index and species id, G4MaterialTable index).
 
-    inline void* operator new(size_t);
-    inline void  operator delete(void*);
-
-    // methods from base class
-    virtual void Draw();
-    virtual void Print();
-
-    // Set methods
-    void SetTrackID (G4int track) { fTrackID = track; };
-    void SetIx (G4int ix) { fix = ix; };
-    void SetIy (G4int iy) { fiy = iy; };
-    void SetIz (G4int iz) { fiz = iz; };
-    void SetEdep (G4double eDep) { fEDep = eDep; };
-    void SetSecondariesEdep (G4double eDep) { fSecondariesEDep = eDep; };
-    void SetDX (G4double dx) { fDX = dx; };
-    void SetKinEMean (G4double kinEMean) { fKinEMean = kinEMean; };
-    void SetPos (G4ThreeVector xyz)	{ fPos = xyz; };
-    void SetParticleDef (G4ParticleDefinition* particleDef)	{ fParticleDef = particleDef; };
-    void SetMat (G4Material* mat)	{ fMat = mat; };
-    void SetVol (G4double vol)	{ fVol = vol; };
-
-    // Get methods
-    G4int GetTrackID() const { return fTrackID; };
-    G4int GetIx() const { return fix; };
-    G4int GetIy() const { return fiy; };
-    G4int GetIz() const { return fiz; };
-    G4double GetEdep() const { return fEDep; };
-    G4double GetSecondariesEdep() const { return fSecondariesEDep; };
-    G4double GetDX() const { return fDX; };
-    G4double GetKinEMean() const { return fKinEMean; };
-    G4ThreeVector GetPos()	const 				{ return fPos; };
-    G4ParticleDefinition* GetParticleDef()	const 		{ return fParticleDef; };
-    G4Material* GetMat() const { return fMat; };
-    G4double GetVol() const { return fVol; };
-
-  private:
-
-      G4int         fTrackID;
-      G4int         fix;
-      G4int         fiy;
-      G4int         fiz;
-      G4double      fEDep;
-      G4double      fSecondariesEDep;
-      G4double      fDX;
-      G4double      fKinEMean;
-      G4ThreeVector fPos;
-      G4ParticleDefinition* fParticleDef;
-      G4Material* 	fMat;
-      G4double 	fVol;
+struct DetectorHit
+{
+  G4int    voxel;       // linear voxel index, (i * nY + j) * nZ + k
+  G4int    trackID;
+  uint16_t speciesID;   // DetectorMatrix species id
+  uint16_t materialID;  // index in the G4MaterialTable
+  G4double eDep;        // energy deposit, secondary electrons included
+  G4double dx;          // step length
+  G4double kinEMean;    // mean kinetic energy along the step
+
+  void Print() const;
 };
 
-typedef G4THitsCollection<DetectorHit> PDD1HitsCollection;
+// Hits collection of one event.
+//
+// It is a view on the hit records of the sensitive detector: the records are
+// kept in a per-thread vector which is cleared, not freed, at every event.
+// An event kept past its end (G4RunManager::KeepTheEvent, visualization of
+// accumulated or multi-threaded events) must not see the records of the next
+// event: before clearing, the sensitive detector calls Keep() on the
+// collection of a kept event, which then holds its own copy.
 
-extern G4ThreadLocal G4Allocator<DetectorHit>* PDD1HitAllocator;
-
-inline void* DetectorHit::operator new(size_t)
+class PDD1HitsCollection : public G4VHitsCollection
 {
+  public:
+    PDD1HitsCollection(const G4String& detName, const G4String& colName,
+                       const std::vector<DetectorHit>* hits);
+    virtual ~PDD1HitsCollection();
 
- if(!PDD1HitAllocator)
-	 PDD1HitAllocator= new G4Allocator<DetectorHit>;
- void *aHit;
+    size_t entries() const { return fHits->size(); }
+    const DetectorHit& operator[](size_t h) const { return (*fHits)[h]; }
 
- aHit = (void *) PDD1HitAllocator->MallocSingle();
- return aHit;
+    // Copy the records, so the collection no longer depends on the arena
+    void Keep();
 
-}
+    // methods from base class
+    virtual size_t GetSize() const { return fHits->size(); }
+    virtual void PrintAllHits();
 
-inline void DetectorHit::operator delete(void *aHit)
-{
-if(!PDD1HitAllocator)
-	PDD1HitAllocator= new G4Allocator<DetectorHit>;
+  private:
+    const std::vector<DetectorHit>* fHits;
 
-PDD1HitAllocator->FreeSingle((DetectorHit*) aHit);
-}
+    // Records of a kept event
+    std::vector<DetectorHit> fKeptHits;
+};
 
 #endif // DetectorHit_h
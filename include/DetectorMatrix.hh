@@ -19,7 +19,11 @@
 #define DetectorMatrix_h 1
 #include <G4ParticleDefinition.hh>
 #include "globals.hh"
+#include "G4Threading.hh"
+#include "VoxelAccumulator.hh"
+#include "StoppingPowerTable.hh"
 #include <vector>
+#include <unordered_map>
 #include <fstream>
 
 
@@ -39,29 +43,52 @@ struct ion
   std::string::size_type len; 	// name length
   G4int Z; 		 				// atomic number
   G4int A; 		 				// mass number
-  G4double* eDep;				// pointer to edep matrix
-  G4double* letN;				// pointer to let dose numerator matrix
-  G4double* letD;				// pointer to let dose denominator matrix
-  G4double* fluence;			// pointer to fluence matrix
+  const G4ParticleDefinition* particleDef; // definition used for stopping powers
+  G4bool hasLet;				// LET is scored (all but neutrons, gammas and electrons)
+  VoxelAccumulator* data;		// edep, let dose numerator/denominator and fluence matrices
   //friend G4bool operator<(const ion& a, const ion& b) {return (a.Z == b.Z) ? b.A < a.A : b.Z < a.Z ;}
   G4bool operator<(const ion& a) const{return (this->Z == a.Z) ? this-> A < a.A : this->Z < a.Z ;}
 };
 
+// Header of a raw dump
+struct RawHeader
+{
+  G4int nX, nY, nZ;
+  G4double massOfVoxel;
+  G4double volumeOfVoxel;
+  G4long nEvents;
+  G4int nSpecies;
+  std::vector<G4double> zEdges;
+  G4double radius;
+};
+
 class DetectorMatrix
 {
 private:
-  DetectorMatrix(G4int nX, G4int nY, G4int nZ,  G4double massOfVoxel);
+  DetectorMatrix(G4int nX, G4int nY, G4int nZ,  G4double massOfVoxel, G4double volumeOfVoxel,
+                 const std::vector<G4double>& zEdges, G4double radius);
 
 
 public:
 
   ~DetectorMatrix();
 
-  // Get object instance only
+  // Get object instance only (worker threads get their own shard, created on first use)
   static DetectorMatrix* GetInstance();
 
-  // Make & Get instance
-  static DetectorMatrix* GetInstance(G4int nX, G4int nY, G4int nZ, G4double massOfVoxel);
+  // Make & Get master instance. With non-uniform depth bins, zEdges holds
+  // their nZ+1 edges; with a radius the grid is cylindrical, nX radial and
+  // nY azimuthal bins up to that radius. In both cases the voxel mass and
+  // volume are the mean ones.
+  static DetectorMatrix* GetInstance(G4int nX, G4int nY, G4int nZ, G4double massOfVoxel, G4double volumeOfVoxel,
+                                     const std::vector<G4double>& zEdges = std::vector<G4double>(),
+                                     G4double radius = 0.);
+
+  // Master instance, the one every shard is merged into
+  static DetectorMatrix* GetMasterInstance(){ return masterInstance; }
+
+  // Delete the shard owned by the calling worker thread
+  static void DeleteInstance();
 
   // All the elements of the matrix are initialized to zero
   void Initialize();
@@ -70,35 +97,116 @@ public:
   // Full list of generated nuclides
   void PrintNuclides(); 
 
-  // Hit array marker (useful to avoid multiple counts of fluence)
-  void ClearHitTrack();
-  G4int* GetHitTrack(G4int i, G4int j, G4int k);
+  // Memory allocated for the data of all the species (bytes)
+  size_t GetMemoryUsage() const;
+
+  // Worker shard: queue this shard to be merged by the master at end of run
+  void ScheduleMerge();
+
+  // Master: merge every scheduled shard in thread order, then reset them
+  void MergeShards();
+
+  // Add the content of another matrix with the same segmentation to this one
+  void Merge(const DetectorMatrix* shard);
+
+  // Sort the species in a canonical order (primaries first, then by Z, A and PDG code)
+  void SortSpecies();
+
+  // Number of events accumulated in the matrix
+  void AddEvent(){ fNumberOfEvents++; }
+  G4long GetNumberOfEvents() const { return fNumberOfEvents; }
+
+  // Grid size
+  G4int GetNX() const { return fNX; }
+  G4int GetNY() const { return fNY; }
+  G4int GetNZ() const { return fNZ; }
+
+  // Depth bin edges (empty when the bins are uniform)
+  const std::vector<G4double>& GetZEdges() const { return fZEdges; }
+
+  // Cylindrical grid: (i,j,k) are the (r,phi,z) bins, radius 0 if Cartesian
+  G4bool IsCylindrical() const { return fRadius > 0.; }
+  G4double GetRadius() const { return fRadius; }
+
+  // Stopping powers used for LET scoring (the master also holds the merged verification statistics)
+  StoppingPowerTable& GetStoppingPowerTable(){ return fStoppingPower; }
+
+  // Dense species id of a particle (primary or secondary), registered on first use
+  G4int GetSpeciesID(const G4ParticleDefinition* particleDef, G4bool isPrimary);
+
+  // Score one step: energy deposit, LET (charged particles but electrons) and fluence
+  void Fill(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit, G4double dx, G4double kinEMean, const G4Material* mat);
 
   // Fill energy deposit matrix
-  G4bool FillEdep(G4int i, G4int j, G4int k, G4double energyDeposit, G4int trackID, G4ParticleDefinition* particleDef);
+  void FillEdep(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit);
 
-  // Fill fluence matrix
-  G4bool FillLet(G4int i, G4int j, G4int k, G4double energyDeposit, G4double dx, G4double kinEMean, G4int trackID, G4ParticleDefinition* particleDef, G4Material* mat);
+  // Fill let matrix
+  void FillLet(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit, G4double dx, G4double kinEMean, const G4Material* mat);
 
   // Fill fluence matrix
-  G4bool FillFluence(G4int i, G4int j, G4int k, G4double dx,G4double vol, G4int trackID, G4ParticleDefinition* particleDef);
+  void FillFluence(G4int speciesID, G4int i, G4int j, G4int k, G4double dx);
    
-  // General store matrix data to filename
-  void StoreAscii(G4String file, G4double** data, G4double unit, G4double scale);
-  void StoreAscii(G4String file, G4int** data, G4double unit, G4double scale);
+  // Store the energy deposit, LET and fluence tables (Edep.out, Let.out, Fluence.out)
+  G4bool StoreAscii();
+
+  // Store every quantity of every species as a NumPy array (nX, nY, nZ)
+  G4bool StoreNpy();
+
+  // Store the non-empty voxels of every species in a sparse binary (COO) file,
+  // in storage order (sorted by voxel index with dense storage only)
+  G4bool StoreCoo();
+
+  // Reduced snapshot of the data scored so far: central axis profile and
+  // species integrals, as the text of Snapshot.out
+  G4String GetSnapshot() const;
+
+  // Write a snapshot, keeping the previous one as <filename>.1
+  static G4bool StoreSnapshot(const G4String& filename, const G4String& snapshot);
+
+  // Store the raw accumulated data (Matrix.raw), which pddmerge can add up
+  G4bool StoreRaw();
+
+  // Describe the binary outputs in a JSON sidecar (Matrix.json)
+  G4bool StoreDescription();
+
+  // Store all the data in the selected output formats, false if any file
+  // could not be written
+  G4bool Store();
+
+  // Files written by the last Store()
+  const std::vector<G4String>& GetStoredFiles() const { return fStoredFiles; }
+
+  // Raw binary dump of the accumulated data (checkpoints, offline merging)
+  void WriteRaw(std::ostream& out) const;
 
-  // Store all energy deposit data to filename
-  void StoreEDepAscii();
+  // Add a raw dump to this matrix, false if it is unreadable or for another grid
+  // (this matrix is then left unchanged)
+  G4bool ReadRaw(std::istream& in);
 
-  // Store all energy deposit data to filename
-  void StoreLetAscii();
+  // Read the header of a raw dump, false if it is not one
+  static G4bool ReadRawHeader(std::istream& in, RawHeader& header);
 
-  // Store all fluence data to filename
-  void StoreFluenceAscii();
+  // Master: hand over the data of the run to a new matrix and start again empty
+  DetectorMatrix* Detach(G4int runID);
+
+  // Copy of the data scored so far, which can be written while this matrix
+  // keeps accumulating
+  DetectorMatrix* Copy() const;
+
+  // Stored value of a quantity before normalisation (the LET is already dose averaged)
+  G4double GetRawOutputValue(size_t speciesID, G4int quantity, G4int i, G4int j, G4int k) const;
+
+  // Normalise a stored value per event and convert it to output units
+  // (Edep: MeV, Let: keV/um, Fluence: 1/cm2)
+  G4double Normalise(G4int quantity, G4double value) const;
 
   // Get index from voxel position
   inline G4int Index(G4int i, G4int j, G4int k) { return (i * fNY + j) * fNZ + k; }
 
+  // Get voxel position from index
+  inline void Indices(G4int index, G4int& i, G4int& j, G4int& k)
+  { k = index % fNZ; index /= fNZ; j = index % fNY; i = index / fNY; }
+
   // Total number of voxels read only access
   G4int GetNvoxel(){return fNX*fNY*fNZ;}
 
@@ -108,21 +216,104 @@ public:
   static G4bool secondary;
   static G4String parent_folder;
 
+  // Stored quantities
+  enum OutputQuantity { kEDepOutput = 0, kLetOutput, kFluenceOutput, kNOutputQuantities };
+
+  // Output formats written by Store (bitmask)
+  enum OutputFormat { kAscii = 1, kNpy = 2, kCoo = 4, kRaw = 8 };
+  static G4int outputFormat;
+
+  // gzip the sparse binary files (only if built with zlib)
+  static G4bool compressOutput;
+
+  // Store a snapshot every N events during the run (0: off)
+  static G4long snapshotEvery;
+
+  // Write the outputs of every run to parent_folder/job<N>/run<ID> (otherwise
+  // to parent_folder, with a _run<ID> suffix after the first run)
+  static G4bool runDirectories;
+
+  // Output folder of this job, parent_folder/job<N>: N is the first index
+  // free when the first run starts, so jobs sharing parent_folder do not
+  // overwrite each other's outputs
+  static G4String JobFolder();
+
+  // Output folder and output file names of a run
+  static G4String RunFolder(G4int runID);
+  static G4String RunFilename(G4int runID, const G4String& name, const G4String& extension);
+
+  // Storage of the per-species voxel data (dense arrays or sparse tiles)
+  static VoxelAccumulator::Storage storage;
+
+  // Layout of the per-species voxel data (one array per quantity or one record per voxel)
+  static VoxelAccumulator::Layout layout;
+
 private:
 
-  std::ofstream ofs;
+  // Allocate a new species with zeroed data
+  ion NewIon(G4bool isPrimary, G4int PDGencoding, const G4String& name, G4int Z, G4int A, const G4ParticleDefinition* particleDef, G4bool hasLet);
 
-  static DetectorMatrix* instance;
+  // Output file name in the output folder, with the run suffix
+  G4String OutputFilename(const G4String& name, const G4String& extension) const;
+
+  // Output file names of a species
+  G4String SpeciesLabel(size_t speciesID) const;
+  G4String NpyFilename(size_t speciesID, G4int quantity) const;
+  G4String CooFilename(size_t speciesID) const;
+
+  // Write one quantity of one species as a .npy file
+  G4bool StoreNpyArray(const G4String& filename, size_t speciesID, G4int quantity);
+
+  // Append a species to the store and register its id
+  G4int AddSpecies(const ion& newIon);
+
+  // Registry key of a species: PDG code (without isomer digit) and primary flag
+  static inline G4long SpeciesKey(G4int PDGencoding, G4bool isPrimary)
+  { return 2 * G4long(PDGencoding) + (isPrimary ? 1 : 0); }
+
+  static G4ThreadLocal DetectorMatrix* instance;
+  static DetectorMatrix* masterInstance;
+
+  // Shards waiting to be merged into the master (thread id, shard)
+  static std::vector<std::pair<G4int, DetectorMatrix*> > pendingShards;
+
+  // Incremented every time the master is rebuilt, so stale shards are recreated
+  static G4int generation;
+  G4int fGeneration;
 
   G4int fNX, fNY, fNZ;
 
   G4double fMassOfVoxel;
+  G4double fVolumeOfVoxel;
+
+  // Depth bin edges (empty when uniform) and voxel volume of every depth bin
+  std::vector<G4double> fZEdges;
+  std::vector<G4double> fVolumeOfSlice;
+
+  // Radius of a cylindrical grid (0 if Cartesian) and area of every radial
+  // bin relative to the mean one
+  G4double fRadius;
+  std::vector<G4double> fRingScale;
 
-  G4int* hitTrack;
+  G4long fNumberOfEvents;
+
+  // Run stored by this matrix and output settings taken at its creation
+  G4int fRunID;
+  G4String fOutputFolder;
+  G4int fOutputFormat;
+  G4bool fSecondary;
+  G4bool fCompress;
+  std::vector<G4String> fStoredFiles;
+  G4bool fRunDirectory;
+
+  StoppingPowerTable fStoppingPower;
 
   // data store
   std::vector <ion> ionStore;
 
+  // species registry: key -> index in ionStore
+  std::unordered_map<G4long, G4int> fSpeciesIndex;
+
 };
 #endif // DetectorMatrix_h
 
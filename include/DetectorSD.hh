@@ -20,6 +20,7 @@
 
 // PDD1 Headers
 #include "DetectorHit.hh"
+#include "ScoringGrid.hh"
 
 // Geant4 Headers
 #include "G4VSensitiveDetector.hh"
@@ -28,7 +29,10 @@
 #include <vector>
 
 class G4Step;
+class G4Event;
 class G4HCofThisEvent;
+class G4ParticleDefinition;
+class G4Material;
 
 // Sensitive detector class
 
@@ -44,9 +48,45 @@ class DetectorSD : public G4VSensitiveDetector
     virtual G4bool ProcessHits(G4Step* step, G4TouchableHistory* history);
     virtual void   EndOfEvent(G4HCofThisEvent* hitCollection);
 
+  public:
+
+    // kHits: one DetectorHit per step, scored at the end of the event (visualization, debugging)
+    // kStreaming: steps are scored straight into the thread's DetectorMatrix, no hits are stored
+    enum ScoringMode { kHits = 0, kStreaming };
+
+    static ScoringMode scoringMode;
+
+    // Geometry of the scoring voxels, the voxel of a step is computed from its points
+    void SetGrid(const ScoringGrid& grid) { fGrid = grid; }
+
+    // The geometry does not stop steps at every voxel wall (regular navigation
+    // or no voxel volumes): steps are split over the voxels they cross
+    void SetSplitSteps(G4bool splitSteps) { fSplitSteps = splitSteps; }
+
   private:
+
+    // Score a deposit in voxel (i,j,k), in the matrix or as a hit
+    void Score(const G4ParticleDefinition* particleDef, G4int trackID, G4int i, G4int j, G4int k,
+               G4double eDep, G4double dx, G4double kinEMean, const G4Material* mat);
+
+    // The previous event was kept by the run manager, its collection still
+    // refers to fHits
+    G4bool PreviousEventKept() const;
+
     PDD1HitsCollection* fHitsCollection;
 
+    // Event of fHitsCollection (only compared, it may have been deleted)
+    const G4Event* fEvent;
+
+    ScoringGrid fGrid;
+    G4bool fSplitSteps;
+
+    // Voxels crossed by the current step (kept to reuse their memory)
+    std::vector<ScoringGrid::Segment> fSegments;
+
+    // Hit records of the current event (one sensitive detector per thread)
+    std::vector<DetectorHit> fHits;
+
 };
 
 
@@ -0,0 +1,77 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef OutputWriter_h
+#define OutputWriter_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+#include "G4Threading.hh"
+
+// C++ Headers
+#include <deque>
+#include <functional>
+
+// Background writer for the end-of-run outputs.
+//
+// Jobs run one at a time, in order, on a dedicated thread, so the next run
+// can start while the previous one is being written. The queue is bounded:
+// Submit blocks while maxPending jobs are waiting, which limits the number of
+// run snapshots held in memory. Without multi-threading support in Geant4
+// the jobs are done in Submit.
+
+class OutputWriter
+{
+public:
+
+  typedef std::function<void()> Job;
+
+  static OutputWriter* GetInstance();
+
+  // Write everything still queued, then stop the writer thread
+  static void DeleteInstance();
+
+  // Queue a job, waiting while the queue is full
+  void Submit(const Job& job);
+
+  // Wait until every queued job has been done
+  void Flush();
+
+public:
+
+  // Maximum number of jobs waiting besides the one being written (0: no limit)
+  static G4int maxPending;
+
+private:
+
+  OutputWriter();
+  ~OutputWriter();
+
+  void Loop();
+
+  static OutputWriter* instance;
+
+  G4Thread* fThread;
+  G4Mutex fMutex;
+  G4Condition fChanged;
+  std::deque<Job> fJobs;
+  G4bool fBusy;
+  G4bool fStop;
+};
+
+#endif // OutputWriter_h
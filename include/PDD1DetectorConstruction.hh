@@ -18,6 +18,9 @@
 #ifndef PDD1DetectorConstruction_h
 #define PDD1DetectorConstruction_h 1
 
+// PDD1 Headers
+#include "ScoringGrid.hh"
+
 // Geant4 Headers
 #include "globals.hh"
 #include "G4VUserDetectorConstruction.hh"
@@ -30,6 +33,9 @@ class G4Material;
 class LET;
 class DetectorMatrix;
 class DetectorSD;
+class PDD1DetectorMessenger;
+class PDD1ParallelWorld;
+class VoxelPhantom;
 
 using namespace std;
 
@@ -52,19 +58,21 @@ public:
 	// Phantom material
 	G4bool SetPhantomMaterial(G4String material);
 	G4bool SetPhantomMaterial(G4String material, G4double concentration);
-    inline G4Material* GetPhantomMaterial(){return fPhantomMaterial;}
+    inline G4Material* GetPhantomMaterial() const {return fPhantomMaterial;}
 
     // Phantom size
     void SetPhantomSize(G4double sizeX, G4double sizeY, G4double sizeZ);
     void GetPhantomSize(G4int& sizeX, G4int& sizeY, G4int& sizeZ)const{ sizeX=fPhantomSize.x(); sizeY=fPhantomSize.y(); sizeZ = fPhantomSize.z(); }
+    inline G4ThreeVector GetPhantomSize() const {return fPhantomSize;}
 
     // Phantom position
     inline void SetPhantomPosition(G4ThreeVector aPhantomPosition){fPhantomPosition=aPhantomPosition;}
+    inline G4ThreeVector GetPhantomPosition() const {return fPhantomPosition;}
 
     // Detector material
     G4bool SetDetectorMaterial(G4String material);
     G4bool SetDetectorMaterial(G4String material, G4double concentration);
-    inline G4Material* GetDetectorMaterial(){return fDetectorMaterial;}
+    inline G4Material* GetDetectorMaterial() const {return fDetectorMaterial;}
 
 	// Concentration
     void SetConcentration (G4double aConcentration);
@@ -73,13 +81,63 @@ public:
     // Detector size
     void SetDetectorSize(G4double sizeX, G4double sizeY, G4double sizeZ);
     void GetDetectorSize(G4int& sizeX, G4int& sizeY, G4int& sizeZ)const{ sizeX=fDetectorSize.x(); sizeY=fDetectorSize.y(); sizeZ = fDetectorSize.z(); }
-
-	// Number of segments of detector
-	void SetDetectorSegmentation(G4int nX, G4int nY, G4int nZ){ fNX=nX; fNY=nY; fNZ=nZ; }
+    inline G4ThreeVector GetDetectorSize() const {return fDetectorSize;}
+
+	// Voxelisation of the detector
+	//  kNested:  Y and X replicas with a nested parameterisation along Z
+	//  kRegular: one G4PhantomParameterisation navigated by G4RegularNavigation,
+	//            which skips the boundaries between voxels of equal material
+	//  kNone:    no voxel volumes, the detector is a homogeneous box and steps
+	//            are split over the scoring grid by the sensitive detector
+	enum Voxelisation { kNested = 0, kRegular, kNone };
+	inline void SetVoxelisation(Voxelisation voxelisation) { fVoxelisation = voxelisation; }
+	inline Voxelisation GetVoxelisation() const { return fVoxelisation; }
+	G4String GetVoxelisationName() const;
+
+	// Heterogeneous detector read from a voxel map and a lookup table (see
+	// VoxelPhantom): the detector size and segmentation become those of the map
+	void SetVoxelPhantom(const G4String& mapFilename, const G4String& tableFilename);
+	inline const G4String& GetVoxelPhantomFile() const { return fVoxelPhantomFile; }
+	inline const VoxelPhantom* GetVoxelPhantom() const { return fVoxelPhantom; }
+
+	// World of the scoring voxels
+	//  kMass:     the voxels are part of the transport geometry
+	//  kParallel: the detector is a homogeneous box and the voxels are built
+	//             in a parallel world, only seen by the scoring
+	enum ScoringWorld { kMass = 0, kParallel };
+	void SetScoringWorld(ScoringWorld scoringWorld);
+	inline ScoringWorld GetScoringWorld() const { return fScoringWorld; }
+
+	// Build the voxels inside the detector box (mass or parallel world)
+	void ConstructVoxels(G4VPhysicalVolume* detector_phys);
+
+	// Number of segments of detector (Cartesian grid, uniform depth bins)
+	void SetDetectorSegmentation(G4int nX, G4int nY, G4int nZ){ fNX=nX; fNY=nY; fNZ=nZ; fZEdges.clear(); fScoringRadius=0.; }
 	void GetDetectorSegmentation(G4int& nX, G4int& nY, G4int& nZ)const{ nX=fNX; nY = fNY; nZ = fNZ; }
 
+	// Non-uniform depth bins, given by their nZ+1 increasing edges or by
+	// sections of a given length and pitch from the front of the detector.
+	// Both set the Z segmentation and size of the detector.
+	void SetDetectorZEdges(const std::vector<G4double>& edges);
+	void SetDetectorZBinning(const std::vector<G4double>& lengths, const std::vector<G4double>& pitches);
+	inline const std::vector<G4double>& GetDetectorZEdges() const { return fZEdges; }
+
+	// Cylindrical scoring grid around the detector axis: nR radial and nPhi
+	// azimuthal bins up to radius, with the depth bins of the detector. The
+	// segmentation becomes (nR, nPhi, nZ) and the voxelisation none.
+	void SetCylindricalSegmentation(G4double radius, G4int nR, G4int nPhi);
+	inline G4double GetScoringRadius() const { return fScoringRadius; }
+
     // Detector position to phantom
     inline void SetDetectorToPhantomPosition(G4ThreeVector aDetectorToPhantomPosition){fDetectorToPhantomPosition=aDetectorToPhantomPosition;}
+    inline G4ThreeVector GetDetectorToPhantomPosition() const {return fDetectorToPhantomPosition;}
+
+    // Geometry of the scoring voxels
+    ScoringGrid GetScoringGrid() const;
+
+    // Voxel mass and volume (set when the geometry is built)
+    inline G4double GetMassOfVoxel() const {return fMassOfVoxel;}
+    inline G4double GetVolumeOfVoxel() const {return fVolumeOfVoxel;}
 
     // Scoring volume vector
     inline vector<G4LogicalVolume*> GetScoringVolumeVector() const { return fScoringVolumeVector; }
@@ -127,10 +185,23 @@ private:
 
     // Detector segmentation
     G4int         				fNX,fNY,fNZ;    // Number of segmentation of water phantom.
+    std::vector<G4double>		fZEdges;		// Depth bin edges from the front face (empty: uniform)
+    G4double					fScoringRadius;	// Radius of a cylindrical grid (0: Cartesian)
 
     // Detector to phantom position
     G4ThreeVector				fDetectorToPhantomPosition;
 
+    // Detector voxelisation
+    Voxelisation				fVoxelisation;
+
+    // Voxel phantom (0 for a homogeneous detector)
+    VoxelPhantom*				fVoxelPhantom;
+    G4String					fVoxelPhantomFile;
+
+    // Scoring world, and the parallel world once it is registered
+    ScoringWorld				fScoringWorld;
+    PDD1ParallelWorld*			fParallelWorld;
+
     // Voxel LV
     G4LogicalVolume*			fVoxelLogicalVolume;
 
@@ -149,5 +220,8 @@ private:
 	// Scoring volume vector
     vector<G4LogicalVolume*>  	fScoringVolumeVector;
 
+	// Messenger
+	PDD1DetectorMessenger*		fMessenger;
+
 };
 #endif
@@ -0,0 +1,72 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef PDD1DetectorMessenger_h
+#define PDD1DetectorMessenger_h 1
+
+// Geant4 Headers
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+class PDD1DetectorConstruction;
+class G4UIdirectory;
+class G4UIcmdWithAString;
+class G4UIcmdWithAnInteger;
+class G4UIcmdWithABool;
+class G4UIcmdWithADoubleAndUnit;
+
+/// Detector messenger class
+///
+/// Commands to configure the phantom geometry (/PDD1/geometry/), the
+/// scoring matrix (/PDD1/scoring/) and its output (/PDD1/output/).
+
+class PDD1DetectorMessenger: public G4UImessenger
+{
+public:
+	PDD1DetectorMessenger(PDD1DetectorConstruction* detector);
+	virtual ~PDD1DetectorMessenger();
+
+	virtual void SetNewValue(G4UIcommand* command, G4String newValue);
+
+private:
+	PDD1DetectorConstruction*	fDetector;
+
+	G4UIdirectory*				fPDD1Directory;
+	G4UIdirectory*				fGeometryDirectory;
+	G4UIdirectory*				fScoringDirectory;
+	G4UIdirectory*				fOutputDirectory;
+
+	G4UIcmdWithAString*			fVoxelisationCmd;
+	G4UIcmdWithAString*			fScoringWorldCmd;
+	G4UIcmdWithAString*			fPhantomCmd;
+	G4UIcmdWithADoubleAndUnit*	fDensityStepCmd;
+	G4UIcmdWithAString*			fZEdgesCmd;
+	G4UIcmdWithAString*			fZBinningCmd;
+	G4UIcmdWithAString*			fCylindricalCmd;
+
+	G4UIcmdWithAString*			fStorageCmd;
+	G4UIcmdWithAString*			fLayoutCmd;
+	G4UIcmdWithAString*			fModeCmd;
+	G4UIcmdWithAnInteger*		fVerifyStoppingPowerCmd;
+
+	G4UIcmdWithAString*			fFormatCmd;
+	G4UIcmdWithABool*			fCompressCmd;
+	G4UIcmdWithAnInteger*		fSnapshotEveryCmd;
+	G4UIcmdWithABool*			fRunDirectoriesCmd;
+};
+
+#endif // PDD1DetectorMessenger_h
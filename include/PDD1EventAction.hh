@@ -37,6 +37,8 @@ public:
 
 	void AddEdep(G4double edep) { fEdep += edep; }
 
+	void AddStep() { fSteps++; }
+
 	void SetRange(G4double range) { fRange = range; }
 
 	void SetK30(G4double kineticEnergy) { fK30 = kineticEnergy; }
@@ -59,6 +61,7 @@ private:
 	G4double     	fK50;
 	G4double     	fK70;
 	G4double     	fK90;
+	G4long     		fSteps;
 	G4int 			hitsCollectionID;
 };
 
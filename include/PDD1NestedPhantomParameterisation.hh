@@ -27,6 +27,7 @@ class G4VPhysicalVolume;
 class G4VTouchable; 
 class G4VSolid;
 class G4Material;
+class VoxelPhantom;
 
 // CSG Entities which may be parameterised/replicated
 //
@@ -51,9 +52,16 @@ class PDD1NestedPhantomParameterisation: public G4VNestedParameterisation
 
     PDD1NestedPhantomParameterisation(const G4ThreeVector& voxelSize,
                                       G4int nz,
-                                      std::vector<G4Material*>& mat);
+                                      std::vector<G4Material*>& mat,
+                                      const VoxelPhantom* phantom = 0);
+      // Voxel materials come from the phantom if given (mat must be its
+      // material list), otherwise every voxel is of mat[0]
    ~PDD1NestedPhantomParameterisation();
 
+    void SetZEdges(const std::vector<G4double>& edges);
+      // Non-uniform Z voxels: nz+1 increasing edges, measured from the
+      // -Z face of the mother volume
+
     // Methods required in derived classes
     // -----------------------------------
     G4Material* ComputeMaterial(G4VPhysicalVolume *currentVol,
@@ -120,7 +128,9 @@ private:
   G4int fNz;
   //
   std::vector<G4double>  fpZ;
+  std::vector<G4double>  fhZ;
   std::vector<G4Material*> fMat;
+  const VoxelPhantom* fPhantom;
 };
 
 #endif //PDD1NestedParameterisation_hh
@@ -0,0 +1,46 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef PDD1ParallelWorld_h
+#define PDD1ParallelWorld_h 1
+
+// Geant4 Headers
+#include "G4VUserParallelWorld.hh"
+#include "globals.hh"
+
+class PDD1DetectorConstruction;
+
+/// Parallel world of the scoring voxels
+///
+/// Holds a ghost copy of the detector box, at its place in the mass
+/// geometry, segmented with the voxelisation of the detector construction.
+/// The transport only sees the homogeneous detector, the sensitive detector
+/// is attached to the voxels of this world.
+
+class PDD1ParallelWorld : public G4VUserParallelWorld
+{
+public:
+	PDD1ParallelWorld(const G4String& worldName, PDD1DetectorConstruction* detector);
+	virtual ~PDD1ParallelWorld();
+
+	virtual void Construct();
+
+private:
+	PDD1DetectorConstruction*	fDetector;
+};
+
+#endif // PDD1ParallelWorld_h
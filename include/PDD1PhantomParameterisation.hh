@@ -0,0 +1,46 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef PDD1PhantomParameterisation_h
+#define PDD1PhantomParameterisation_h 1
+
+// Geant4 Headers
+#include "G4PhantomParameterisation.hh"
+
+class VoxelPhantom;
+
+/// Regular structure parameterisation of the detector voxels
+///
+/// The materials come from a VoxelPhantom, with 2 bytes per voxel, or are
+/// all the same for a homogeneous detector, instead of the per-voxel size_t
+/// index array of G4PhantomParameterisation.
+
+class PDD1PhantomParameterisation : public G4PhantomParameterisation
+{
+public:
+	PDD1PhantomParameterisation(const VoxelPhantom* phantom, G4Material* material);
+	virtual ~PDD1PhantomParameterisation();
+
+	virtual G4Material* ComputeMaterial(const G4int copyNo, G4VPhysicalVolume* currentVol,
+			const G4VTouchable* parentTouch = 0);
+
+private:
+	const VoxelPhantom*		fPhantom;
+	G4Material*				fMaterial;
+};
+
+#endif // PDD1PhantomParameterisation_h
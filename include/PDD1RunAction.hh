@@ -24,6 +24,8 @@
 #include <vector>
 
 class G4Run;
+class PDD1RunMessenger;
+class RunManifest;
 
 /// Run action class
 ///
@@ -43,11 +45,18 @@ class PDD1RunAction : public G4UserRunAction
     void CreateHistos();
     void CreateNTuples();
     inline void AddEdep(G4double edep){fEdep += edep; fEdep2 += edep*edep;}
+    inline void AddSteps(G4long steps){fSteps += G4double(steps);}
 
   private:
 
     G4Accumulable<G4double> fEdep;
     G4Accumulable<G4double> fEdep2;
+    G4Accumulable<G4double> fSteps;
+
+    PDD1RunMessenger* fMessenger;
+
+    // Master: manifest of the run in progress
+    RunManifest* fManifest;
 };
 
 #endif
@@ -0,0 +1,61 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef PDD1RunMessenger_h
+#define PDD1RunMessenger_h 1
+
+// Geant4 Headers
+#include "G4UImessenger.hh"
+#include "globals.hh"
+
+class G4UIdirectory;
+class G4UIcmdWithAString;
+class G4UIcmdWithAnInteger;
+class G4UIcmdWithADouble;
+class G4UIcmdWithABool;
+
+/// Run messenger class
+///
+/// Commands to checkpoint the scoring matrix and to resume an
+/// interrupted run (/PDD1/run/), and to select the tracks stored in the
+/// SecondariesProduction ntuple and the secondary yields (/PDD1/secondaries/).
+
+class PDD1RunMessenger: public G4UImessenger
+{
+public:
+	PDD1RunMessenger();
+	virtual ~PDD1RunMessenger();
+
+	virtual void SetNewValue(G4UIcommand* command, G4String newValue);
+
+private:
+	G4UIdirectory*				fRunDirectory;
+
+	G4UIcmdWithAnInteger*		fCheckpointEveryCmd;
+	G4UIcmdWithADouble*			fCheckpointMinutesCmd;
+	G4UIcmdWithAString*			fCheckpointFileCmd;
+	G4UIcmdWithAString*			fResumeCmd;
+
+	G4UIdirectory*				fSecondariesDirectory;
+	G4UIcmdWithAnInteger*		fSampleEveryCmd;
+	G4UIcmdWithAString*			fParticlesCmd;
+	G4UIcmdWithAString*			fCreatorsCmd;
+	G4UIcmdWithABool*			fYieldsCmd;
+};
+
+#endif // PDD1RunMessenger_h
@@ -0,0 +1,106 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef RunManifest_h
+#define RunManifest_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+
+// C++ Headers
+#include <vector>
+
+class G4Run;
+
+// Machine readable record of a run (manifest.json in the run output folder):
+// geometry and segmentation, materials, beam (/gps/ commands), physics
+// constructors, threads, seed and random engine state, events and steps, the
+// checkpoint a resumed run started from, wall and CPU
+// time of the setup, event loop and output phases, peak memory, the UI
+// command history and the output files with their size and CRC-32. The
+// outputs are the files recorded with AddOutput by the code which wrote them,
+// so nothing else found in the output folder is attributed to the run.
+//
+// The master creates one at the beginning of every run, completes it at the
+// end of the event loop and writes it once the outputs have been stored.
+
+class RunManifest
+{
+public:
+
+  // Master, at the beginning of the run: creates the run output folder
+  explicit RunManifest(const G4Run* run);
+
+  // Master, at the end of the event loop
+  void EndOfEventLoop(const G4Run* run);
+
+  // Master, once the accumulables are merged: steps of all the threads
+  void SetSteps(G4double steps) { fSteps = steps; }
+
+  // After every output of the run has been written
+  void Write();
+
+  // Program start, the reference of the first setup phase. Also makes the UI
+  // manager keep up to maxCommands commands for the manifests
+  static void Start();
+
+  // Any thread: a file written for a run, to be listed in its manifest
+  static void AddOutput(G4int runID, const G4String& filename);
+
+  // Master: the next run resumes a checkpoint of a run of target events, which
+  // holds the first events of it. seed is the one given to the engine for the
+  // resumed events (0: the checkpoint engine state continues the run exactly)
+  static void SetResume(const G4String& checkpoint, G4long events, G4long target, G4long seed);
+
+public:
+
+  // Seed given to the random engine at start up
+  static G4long seed;
+
+  // Commands kept in the UI history, which the manifest records
+  static G4int maxCommands;
+
+private:
+
+  // Wall and CPU (user + system, all threads) time in seconds
+  static G4double WallTime();
+  static G4double CpuTime();
+
+  G4int fRunID;
+  G4String fFolder;
+  G4String fConfiguration;  // JSON members known at the beginning of the run
+  G4String fEngineState;
+  G4long fEventsRequested;
+  G4long fEvents;
+  G4long fResumedEvents;
+  G4double fSteps;
+  std::vector<G4String> fCommands;
+
+  G4double fSetupWall, fSetupCpu;
+  G4double fLoopWall, fLoopCpu;
+  G4double fLoopEndWall, fLoopEndCpu;
+
+  // End of the previous event loop (program start for the first run)
+  static G4double lastWall, lastCpu;
+
+  // Checkpoint resumed by the next run (see SetResume)
+  static G4String resumeCheckpoint;
+  static G4long resumeEvents, resumeTarget, resumeSeed;
+};
+
+#endif // RunManifest_h
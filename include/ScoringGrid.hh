@@ -0,0 +1,201 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef ScoringGrid_h
+#define ScoringGrid_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+#include "G4RotationMatrix.hh"
+#include "G4PhysicalConstants.hh"
+
+// C++ Headers
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Geometry of the scoring voxels: a box of nX x nY x nZ voxels given by its
+// centre, full size and rotation in the global frame.
+//
+// Voxel indices and volume are computed arithmetically from positions, so
+// the scoring does not depend on how the detector is built (replicas,
+// regular structure, parallel world or a homogeneous box). Indices follow
+// DetectorMatrix: i along x, j along y, k along z.
+//
+// The depth bins may be non-uniform: given nZ+1 increasing Z edges, k is
+// found by a binary search over them instead of a division by the pitch, so
+// fine bins can be used only where the dose gradient is steep.
+//
+// Traverse() walks a step through the voxels with the 3D DDA of Amanatides
+// and Woo, so steps that are not stopped at the voxel walls can be shared
+// among all the voxels they cross.
+//
+// A cylindrical grid (see Cylinder()) bins around the Z axis of the grid
+// instead: i is the radial bin, j the azimuthal bin (from the x axis) and k
+// the depth bin. Its steps are split at the crossings with the cylinders,
+// half-planes and Z planes between the bins.
+
+class ScoringGrid
+{
+public:
+
+  // Part of a step inside one voxel, starting at distance start from the
+  // first point of the step
+  struct Segment
+  {
+    G4int i, j, k;
+    G4double length;
+    G4double start;
+  };
+
+  ScoringGrid();
+  ScoringGrid(const G4ThreeVector& center, const G4ThreeVector& size, G4int nX, G4int nY, G4int nZ,
+              const G4RotationMatrix& rotation = G4RotationMatrix());
+
+  // Grid with non-uniform depth bins: edgesZ holds the nZ+1 increasing Z
+  // edges in the grid frame, from 0 to size.z()
+  ScoringGrid(const G4ThreeVector& center, const G4ThreeVector& size, G4int nX, G4int nY,
+              const std::vector<G4double>& edgesZ, const G4RotationMatrix& rotation = G4RotationMatrix());
+
+  // Cylindrical grid around an axis along Z through center: nR radial bins up
+  // to radius, nPhi azimuthal bins, and nZ uniform depth bins over length or
+  // the depth bins given by edgesZ (from 0 to length)
+  static ScoringGrid Cylinder(const G4ThreeVector& center, G4double radius, G4int nR, G4int nPhi,
+                              G4double length, G4int nZ, const std::vector<G4double>& edgesZ = std::vector<G4double>(),
+                              const G4RotationMatrix& rotation = G4RotationMatrix());
+
+  // Global position in the grid frame: origin at the outer corner of voxel
+  // (0,0,0), axes along the grid
+  inline G4ThreeVector ToGrid(const G4ThreeVector& position) const;
+
+  // Voxel holding a global position, false if it is outside the grid
+  inline G4bool Locate(const G4ThreeVector& position, G4int& i, G4int& j, G4int& k) const;
+
+  // Voxels crossed by the straight segment between two global positions, in
+  // order, with the length inside each one and where it begins along the
+  // segment. Parts outside the grid and slivers below the geometry tolerance
+  // are left out.
+  void Traverse(const G4ThreeVector& start, const G4ThreeVector& end, std::vector<Segment>& segments) const;
+
+  G4int GetNX() const { return fNX; }
+  G4int GetNY() const { return fNY; }
+  G4int GetNZ() const { return fNZ; }
+
+  const G4ThreeVector& GetCenter() const { return fCenter; }
+  // Pitch (mean pitch along Z if the depth bins are non-uniform; radial
+  // pitch and azimuthal pitch in radians for a cylindrical grid)
+  const G4ThreeVector& GetPitch() const { return fPitch; }
+
+  // Cylindrical grid, and its radius
+  G4bool IsCylindrical() const { return fCylindrical; }
+  G4double GetRadius() const { return fRadius; }
+
+  // Mean voxel volume, and mean volume of the voxels of depth bin k
+  G4double GetVoxelVolume() const { return GetCrossSection() * fPitch.z(); }
+  G4double GetVoxelVolume(G4int k) const { return GetCrossSection() * GetPitchZ(k); }
+
+  // Depth bins: uniform or not, Z edges in the grid frame (empty when
+  // uniform) and thickness of bin k
+  G4bool IsUniformZ() const { return fEdgesZ.empty(); }
+  const std::vector<G4double>& GetEdgesZ() const { return fEdgesZ; }
+  G4double GetPitchZ(G4int k) const { return fEdgesZ.empty() ? fPitch.z() : fEdgesZ[k + 1] - fEdgesZ[k]; }
+
+private:
+
+  // Mean cross section of a voxel, across the depth axis
+  G4double GetCrossSection() const
+  { return fCylindrical ? pi * fRadius * fRadius / (fNX * fNY) : fPitch.x() * fPitch.y(); }
+
+  // Voxel of a position in the grid frame of a cylindrical grid
+  inline void LocateCylinder(const G4ThreeVector& local, G4int& i, G4int& j) const;
+
+  // Traverse() of a cylindrical grid, from a position and a displacement in
+  // the grid frame
+  void TraverseCylinder(const G4ThreeVector& origin, const G4ThreeVector& direction,
+                        std::vector<Segment>& segments) const;
+
+  // Grid coordinate of wall n along an axis
+  inline G4double Wall(G4int axis, G4int n) const
+  { return (axis == 2 && !fEdgesZ.empty()) ? fEdgesZ[n] : n * fPitch[axis]; }
+
+  // Depth bin of a grid coordinate (-1 before the first edge, nZ after the last)
+  inline G4int LocateZ(G4double z) const;
+
+  G4ThreeVector fCenter;
+  G4ThreeVector fHalfSize;
+  G4ThreeVector fPitch;
+  G4ThreeVector fInversePitch;
+
+  // Global to grid rotation, skipped when the grid is not rotated
+  G4RotationMatrix fInverseRotation;
+  G4bool fRotated;
+
+  G4int fNX, fNY, fNZ;
+
+  // Z edges of non-uniform depth bins, empty when they are uniform
+  std::vector<G4double> fEdgesZ;
+
+  // Cylindrical grid: the box above is the one around the cylinder
+  G4bool fCylindrical;
+  G4double fRadius;
+};
+
+inline void ScoringGrid::LocateCylinder(const G4ThreeVector& local, G4int& i, G4int& j) const
+{
+  G4double x = local.x() - fHalfSize.x();
+  G4double y = local.y() - fHalfSize.y();
+  i = G4int(std::sqrt(x * x + y * y) * fInversePitch.x());
+  j = 0;
+  if (fNY > 1)
+  {
+    G4double phi = std::atan2(y, x);
+    if (phi < 0.) phi += twopi;
+    j = std::min(G4int(phi * fInversePitch.y()), fNY - 1);
+  }
+}
+
+inline G4int ScoringGrid::LocateZ(G4double z) const
+{
+  if (fEdgesZ.empty()) return G4int(std::floor(z * fInversePitch.z()));
+  return G4int(std::upper_bound(fEdgesZ.begin(), fEdgesZ.end(), z) - fEdgesZ.begin()) - 1;
+}
+
+inline G4ThreeVector ScoringGrid::ToGrid(const G4ThreeVector& position) const
+{
+  G4ThreeVector local = position - fCenter;
+  if (fRotated) local = fInverseRotation * local;
+  return local + fHalfSize;
+}
+
+inline G4bool ScoringGrid::Locate(const G4ThreeVector& position, G4int& i, G4int& j, G4int& k) const
+{
+  G4ThreeVector local = ToGrid(position);
+  if (fCylindrical)
+  {
+    LocateCylinder(local, i, j);
+  }
+  else
+  {
+    i = G4int(std::floor(local.x() * fInversePitch.x()));
+    j = G4int(std::floor(local.y() * fInversePitch.y()));
+  }
+  k = LocateZ(local.z());
+  return i >= 0 && i < fNX && j >= 0 && j < fNY && k >= 0 && k < fNZ;
+}
+
+#endif // ScoringGrid_h
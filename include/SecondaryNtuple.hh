@@ -0,0 +1,67 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef SecondaryNtuple_h
+#define SecondaryNtuple_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+
+class G4Track;
+
+// SecondariesProduction ntuple with dictionary encoded columns.
+//
+// The creator process, creator model and particle of every track are stored
+// as integer codes. The codes are shared by all the threads, and the code to
+// name tables are written once per file, as the Processes, Models and
+// Particles ntuples. Tracks can be sampled (one in sampleEvery) and filtered by
+// particle and creator process.
+
+class SecondaryNtuple
+{
+public:
+
+  // Book the secondaries ntuple and its three dictionaries (consecutive ids)
+  static void Book();
+
+  // Fill a row for the track if it passes the filters and the sampling
+  static void Fill(const G4Track* track, G4double totalEdep);
+
+  // Master: fill the dictionaries, before the file is written
+  static void FillDictionaries();
+
+  // Delete the lookup caches of the calling thread
+  static void ClearCache();
+
+  // Space separated particle / creator process names ("gun" for primaries),
+  // empty to keep every track
+  static void SetParticleFilter(const G4String& names);
+  static void SetCreatorFilter(const G4String& names);
+
+public:
+
+  // Keep one in every N tracks (1: all of them)
+  static G4int sampleEvery;
+
+private:
+
+  // Id of the secondaries ntuple
+  static G4int firstNtupleId;
+};
+
+#endif // SecondaryNtuple_h
@@ -0,0 +1,132 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+#ifndef SecondaryYieldScorer_h
+#define SecondaryYieldScorer_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+
+// C++ Headers
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+class G4Track;
+class G4ParticleDefinition;
+class G4VProcess;
+
+// Aggregated secondary production: number of tracks and histograms of the
+// vertex kinetic energy and of the track length for every (particle, creator
+// process, creator model). Histograms have kBinsPerDecade logarithmic bins
+// plus an underflow and an overflow bin, so the memory and the output size do
+// not depend on the number of tracks.
+//
+// Every thread fills its own instance; at the end of the run workers schedule
+// theirs and the master merges them and stores SecondaryYields.out.
+
+class SecondaryYieldScorer
+{
+public:
+
+  // Instance of the calling thread, created on first use
+  static SecondaryYieldScorer* GetInstance();
+
+  // Delete the instance of the calling thread
+  static void DeleteInstance();
+
+  // Score a track at the end of its tracking
+  void Fill(const G4Track* track);
+
+  // Worker: queue this instance to be merged by the master at end of run
+  void ScheduleMerge();
+
+  // Master: merge every scheduled instance in thread order, then reset them
+  void MergeShards();
+
+  // Add the content of another scorer
+  void Merge(const SecondaryYieldScorer* other);
+
+  void Clear();
+
+  // Store the table with the other outputs of the run
+  void Store(G4int runID, G4long nEvents) const;
+
+public:
+
+  // Score the secondaries (on by default)
+  static G4bool enabled;
+
+  static const G4int kBinsPerDecade = 10;
+
+  // Vertex kinetic energy: 1 eV - 10 GeV
+  static const G4int kEnergyDecades = 10;
+  static const G4double kEnergyMin;
+
+  // Track length: 1 nm - 10 m
+  static const G4int kLengthDecades = 10;
+  static const G4double kLengthMin;
+
+private:
+
+  SecondaryYieldScorer();
+
+  // Histograms of one (particle, process, model)
+  struct Row
+  {
+    G4String particle;
+    G4String process;
+    G4String model;
+    std::vector<G4long> counts;    // tracks, energy bins, length bins
+  };
+
+  // Row of a label, created if needed
+  G4int GetRow(const G4String& particle, const G4String& process, const G4String& model);
+
+  // Bin of a value in a log axis starting at min (0: underflow, last: overflow)
+  static inline G4int Bin(G4double value, G4double min, G4int decades);
+
+  static G4int NumberOfCounts()
+  { return 1 + (kEnergyDecades * kBinsPerDecade + 2) + (kLengthDecades * kBinsPerDecade + 2); }
+
+  static G4ThreadLocal SecondaryYieldScorer* instance;
+
+  // Scorers waiting to be merged into the master (thread id, scorer)
+  static std::vector<std::pair<G4int, SecondaryYieldScorer*> > pendingShards;
+
+  std::vector<Row> fRows;
+
+  // Row index by label and by (particle, creator process, model id) of this thread
+  std::map<G4String, G4int> fRowIndex;
+  struct Key
+  {
+    const G4ParticleDefinition* particle;
+    const G4VProcess* process;
+    G4int model;
+    G4bool operator==(const Key& other) const
+    { return particle == other.particle && process == other.process && model == other.model; }
+  };
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    { return std::hash<const void*>()(key.particle) ^ (std::hash<const void*>()(key.process) << 1) ^ size_t(key.model); }
+  };
+  std::unordered_map<Key, G4int, KeyHash> fRowCache;
+};
+
+#endif // SecondaryYieldScorer_h
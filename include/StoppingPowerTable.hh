@@ -0,0 +1,87 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef StoppingPowerTable_h
+#define StoppingPowerTable_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+#include "G4EmCalculator.hh"
+
+// C++ Headers
+#include <map>
+#include <vector>
+
+class G4ParticleDefinition;
+class G4Material;
+
+// Cache of electronic stopping powers used for LET scoring.
+//
+// For every (particle, material) pair a log-spaced dE/dx table is built from
+// G4EmCalculator the first time it is needed, and later lookups interpolate
+// it. In verification mode one lookup every N is also computed directly and
+// the maximum relative difference is recorded.
+
+class StoppingPowerTable
+{
+public:
+
+  StoppingPowerTable();
+  ~StoppingPowerTable();
+
+  // Unrestricted electronic stopping power at kinetic energy kinE
+  G4double GetElectronicDEDX(G4double kinE, const G4ParticleDefinition* particleDef, const G4Material* mat);
+
+  // Drop all the tables
+  void Clear();
+
+  // Verification statistics
+  void MergeVerification(const StoppingPowerTable& other);
+  void ResetVerification();
+  void PrintVerification() const;
+
+public:
+
+  // Compare one lookup every verifyEvery with G4EmCalculator (0 disables it)
+  static G4int verifyEvery;
+
+private:
+
+  typedef std::pair<const G4ParticleDefinition*, const G4Material*> Key;
+
+  const std::vector<G4double>& GetTable(const G4ParticleDefinition* particleDef, const G4Material* mat);
+
+  void Verify(G4double kinE, G4double dedx, const G4ParticleDefinition* particleDef, const G4Material* mat);
+
+  G4EmCalculator fCalculator;
+
+  std::map<Key, std::vector<G4double> > fTables;
+
+  // Last table used: consecutive hits nearly always share particle and material
+  Key fLastKey;
+  const std::vector<G4double>* fLastTable;
+
+  // Verification
+  G4long fNLookups;
+  G4long fNVerified;
+  G4double fMaxRelError;
+  G4double fMaxErrorEnergy;
+  G4String fMaxErrorParticle;
+  G4String fMaxErrorMaterial;
+};
+
+#endif // StoppingPowerTable_h
@@ -0,0 +1,184 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef VoxelAccumulator_h
+#define VoxelAccumulator_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+
+// C++ Headers
+#include <iosfwd>
+#include <vector>
+
+// Scored quantities of one species over the voxels of the detector.
+//
+// Dense storage keeps one full array per quantity. Sparse storage splits the
+// grid in tiles of 8x8x8 voxels which are allocated the first time one of
+// their voxels is filled, so memory scales with the voxels actually touched.
+//
+// With the planar layout the values of one quantity are contiguous; with the
+// interleaved layout the kNQuantities values of one voxel are, so a fill of
+// all the quantities of a voxel touches a single cache line.
+
+class VoxelAccumulator
+{
+public:
+
+  enum Quantity { kEDep = 0, kLetN, kLetD, kFluence, kNQuantities };
+  enum Storage { kDense = 0, kSparse };
+  enum Layout { kPlanar = 0, kInterleaved };
+
+  VoxelAccumulator(G4int nX, G4int nY, G4int nZ, Storage storage, Layout layout = kPlanar);
+  ~VoxelAccumulator();
+
+  // Add a value to the quantity of voxel (i,j,k)
+  inline void Add(Quantity q, G4int i, G4int j, G4int k, G4double value);
+
+  // Quantity of voxel (i,j,k), zero if it was never filled
+  inline G4double Get(Quantity q, G4int i, G4int j, G4int k) const;
+
+  // Add the content of another accumulator with the same segmentation
+  void Merge(const VoxelAccumulator& other);
+
+  // Sum of a quantity over all the voxels (only the allocated tiles are visited)
+  G4double Total(Quantity q) const;
+
+  // Call visit(v, values) for every voxel with a non-zero quantity, where v is
+  // the voxel index (i * nY + j) * nZ + k and values its kNQuantities values.
+  // Only the allocated tiles are visited, so the voxels of sparse storage come
+  // in tile order
+  template <class Visitor> void ForEachVoxel(Visitor visit) const;
+
+  // Binary dump of the non-empty voxels (native byte order):
+  // uint64 count, then count x { uint32 voxel index, float64 values[kNQuantities] }
+  void Write(std::ostream& out) const;
+
+  // Add the content of a binary dump, false if it is truncated or does not fit
+  // the grid, in which case nothing is added
+  G4bool Read(std::istream& in);
+
+  // Memory allocated for voxel data (bytes)
+  size_t GetMemoryUsage() const;
+
+  Storage GetStorage() const { return fStorage; }
+  Layout GetLayout() const { return fLayout; }
+
+private:
+
+  VoxelAccumulator(const VoxelAccumulator&);
+  VoxelAccumulator& operator=(const VoxelAccumulator&);
+
+  // Tile index and position inside the tile of voxel (i,j,k)
+  inline G4int TileIndex(G4int i, G4int j, G4int k) const
+  { return ((i >> kTileBits) * fTY + (j >> kTileBits)) * fTZ + (k >> kTileBits); }
+  inline G4int TileOffset(G4int i, G4int j, G4int k) const
+  { return (((i & kTileMask) << kTileBits | (j & kTileMask)) << kTileBits) | (k & kTileMask); }
+
+  // Position of quantity q of voxel v in an array of n voxels
+  inline size_t Offset(Quantity q, size_t v, size_t n) const
+  { return (fLayout == kPlanar) ? q * n + v : v * kNQuantities + q; }
+
+  // Values of voxel v of an array of n voxels, false if they are all zero
+  inline G4bool Gather(const G4double* data, size_t v, size_t n, G4double* values) const;
+
+  G4double* NewTile();
+
+  static const G4int kTileBits = 3;
+  static const G4int kTileMask = (1 << kTileBits) - 1;
+  static const G4int kTileSize = 1 << (3 * kTileBits);
+
+  G4int fNX, fNY, fNZ;
+  size_t fNVoxel;
+  Storage fStorage;
+  Layout fLayout;
+
+  // Dense: fNVoxel voxels with kNQuantities values each (see Offset)
+  G4double* fData;
+
+  // Sparse: number of tiles per axis and tile table (NULL until touched),
+  // each tile holds kTileSize voxels with kNQuantities values each
+  G4int fTX, fTY, fTZ;
+  std::vector<G4double*> fTiles;
+  size_t fNTiles;
+};
+
+inline void VoxelAccumulator::Add(Quantity q, G4int i, G4int j, G4int k, G4double value)
+{
+  if (fStorage == kDense)
+  {
+    fData[Offset(q, (i * fNY + j) * fNZ + k, fNVoxel)] += value;
+    return;
+  }
+
+  G4double*& tile = fTiles[TileIndex(i, j, k)];
+  if (!tile) tile = NewTile();
+  tile[Offset(q, TileOffset(i, j, k), kTileSize)] += value;
+}
+
+inline G4double VoxelAccumulator::Get(Quantity q, G4int i, G4int j, G4int k) const
+{
+  if (fStorage == kDense) return fData[Offset(q, (i * fNY + j) * fNZ + k, fNVoxel)];
+
+  const G4double* tile = fTiles[TileIndex(i, j, k)];
+  return tile ? tile[Offset(q, TileOffset(i, j, k), kTileSize)] : 0.;
+}
+
+inline G4bool VoxelAccumulator::Gather(const G4double* data, size_t v, size_t n, G4double* values) const
+{
+  G4bool empty = true;
+  for (G4int q=0; q<kNQuantities; q++)
+  {
+    values[q] = data[Offset(Quantity(q), v, n)];
+    if (values[q] != 0.) empty = false;
+  }
+  return !empty;
+}
+
+template <class Visitor>
+void VoxelAccumulator::ForEachVoxel(Visitor visit) const
+{
+  G4double values[kNQuantities];
+
+  if (fStorage == kDense)
+  {
+    for (size_t v=0; v<fNVoxel; v++)
+      if (Gather(fData, v, fNVoxel, values)) visit(v, values);
+    return;
+  }
+
+  // Voxels of the edge tiles outside the grid are never filled
+  for (size_t t=0; t<fTiles.size(); t++)
+  {
+    const G4double* tile = fTiles[t];
+    if (!tile) continue;
+
+    const G4int i0 = (t / (size_t(fTY) * fTZ)) << kTileBits;
+    const G4int j0 = ((t / fTZ) % fTY) << kTileBits;
+    const G4int k0 = (t % fTZ) << kTileBits;
+    for (G4int v=0; v<kTileSize; v++)
+    {
+      if (!Gather(tile, v, kTileSize, values)) continue;
+      G4int i = i0 + (v >> (2 * kTileBits));
+      G4int j = j0 + ((v >> kTileBits) & kTileMask);
+      G4int k = k0 + (v & kTileMask);
+      visit((size_t(i) * fNY + j) * fNZ + k, values);
+    }
+  }
+}
+
+#endif // VoxelAccumulator_h
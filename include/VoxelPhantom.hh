@@ -0,0 +1,105 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+#ifndef VoxelPhantom_h
+#define VoxelPhantom_h 1
+
+// Geant4 Headers
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+// C++ Headers
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+class G4Material;
+
+// Heterogeneous voxel phantom (CT or material map) read from a raw binary
+// voxel map (native byte order):
+//
+//   char[6] "PDDVOX", uint16 version, int32 nX, nY, nZ, float64 voxel size
+//   x, y, z (mm), uint16 kind (0: Hounsfield units, 1: material indices),
+//   float64 rescale intercept (HU = value + intercept, kind 0 only), then
+//   nX*nY*nZ uint16 values, x fastest: voxel ix + nX*(iy + nY*iz).
+//
+// The lookup table is a text file with one row per value range ('#' starts
+// a comment):
+//
+//   lower upper material densityLower densityUpper
+//
+// Values v (HU or indices) with lower <= v < upper get the material, with a
+// density interpolated linearly in g/cm3. Densities are rounded to
+// densityStep, and one material is built per base material and density, so
+// every voxel keeps a 2 byte index into the material list.
+
+class VoxelPhantom
+{
+public:
+
+  enum Kind { kHounsfield = 0, kMaterialIndex = 1 };
+
+  VoxelPhantom();
+  ~VoxelPhantom();
+
+  // Read a voxel map and convert it with a lookup table, false if they cannot be read
+  G4bool Load(const G4String& mapFilename, const G4String& tableFilename);
+
+  G4int GetNX() const { return fNX; }
+  G4int GetNY() const { return fNY; }
+  G4int GetNZ() const { return fNZ; }
+  const G4ThreeVector& GetVoxelSize() const { return fVoxelSize; }
+  G4ThreeVector GetSize() const { return G4ThreeVector(fNX * fVoxelSize.x(), fNY * fVoxelSize.y(), fNZ * fVoxelSize.z()); }
+
+  // Material of voxel ix + nX*(iy + nY*iz)
+  inline G4Material* GetMaterial(size_t copyNo) const { return fMaterials[fIndices[copyNo]]; }
+
+  // Materials of the phantom, in index order
+  std::vector<G4Material*>& GetMaterials() { return fMaterials; }
+  const std::vector<G4Material*>& GetMaterials() const { return fMaterials; }
+
+  // Memory allocated for the voxel indices (bytes)
+  size_t GetMemoryUsage() const { return fIndices.size() * sizeof(uint16_t); }
+
+public:
+
+  // Density step of the materials built from the lookup table
+  static G4double densityStep;
+
+private:
+
+  struct LookupRow
+  {
+    G4double lower, upper;
+    G4Material* material;
+    G4double densityLower, densityUpper;
+  };
+
+  G4bool ReadTable(const G4String& tableFilename, std::vector<LookupRow>& table) const;
+
+  // Index of the material of a row with a given density, built on first use
+  uint16_t MaterialIndex(const LookupRow& row, G4double density);
+
+  G4int fNX, fNY, fNZ;
+  G4ThreeVector fVoxelSize;
+
+  std::vector<uint16_t> fIndices;
+  std::vector<G4Material*> fMaterials;
+  std::map<G4String, uint16_t> fMaterialIndex;
+};
+
+#endif // VoxelPhantom_h
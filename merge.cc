@@ -0,0 +1,167 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// Offline merge of the raw dumps (Matrix.raw) of independent runs.
+//
+// The raw dumps hold the accumulated sums of every species (energy deposit,
+// LET numerator and denominator, fluence) and the number of events of the
+// run, so adding them up and normalising by the total number of events gives
+// the same outputs as a single run with all the events.
+//
+//   ./pddmerge [-o folder] [-f formats] [-j threads] [-z] run1/Matrix.raw run2/Matrix.raw ...
+
+// PPD1 Headers
+#include "DetectorMatrix.hh"
+
+// Geant4 Headers
+#include "globals.hh"
+
+// C++ Headers
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+void PrintUsage() {
+	G4cerr << " Usage: " << G4endl;
+	G4cerr << " ./pddmerge [-o output_folder ] "
+			<< " [-f formats {'ascii','npy','coo','raw'}, comma separated]"
+			<< " [-j threads ]"
+			<< " [-z (gzip coo files)]"
+			<< " Matrix.raw ..."
+			<< G4endl;
+}
+
+// Dumps added up by one thread
+struct Share
+{
+	DetectorMatrix* shard;
+	G4bool ok;
+};
+
+// Add the raw dumps thread, thread + nThreads, ... to the shard of the calling thread
+void MergeFiles(const std::vector<G4String>& files, G4int thread, G4int nThreads, Share* share)
+{
+	share->shard = DetectorMatrix::GetInstance();
+	share->ok = true;
+
+	std::vector<char> buffer(1 << 20);
+	for (size_t f=thread; f<files.size(); f+=nThreads)
+	{
+		std::ifstream in;
+		in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+		in.open(files[f], std::ios::in | std::ios::binary);
+		if (!in || !share->shard -> ReadRaw(in))
+		{
+			G4cerr << "pddmerge: cannot read " << files[f] << G4endl;
+			share->ok = false;
+			return;
+		}
+	}
+}
+}
+
+int main(int argc,char** argv)
+{
+	G4String folder("data");
+	G4int format = DetectorMatrix::kAscii;
+	G4int nThreads = std::thread::hardware_concurrency();
+	std::vector<G4String> files;
+
+	for ( G4int i=1; i<argc; i++ )
+	{
+		G4String arg(argv[i]);
+		if ( arg == "-o" && i+1 < argc ) folder = argv[++i];
+		else if ( arg == "-j" && i+1 < argc ) nThreads = std::atoi(argv[++i]);
+		else if ( arg == "-z" ) DetectorMatrix::compressOutput = true;
+		else if ( arg == "-f" && i+1 < argc )
+		{
+			format = 0;
+			std::istringstream formats(argv[++i]);
+			std::string token;
+			while (std::getline(formats, token, ','))
+			{
+				if (token == "ascii") format |= DetectorMatrix::kAscii;
+				else if (token == "npy") format |= DetectorMatrix::kNpy;
+				else if (token == "coo") format |= DetectorMatrix::kCoo;
+				else if (token == "raw") format |= DetectorMatrix::kRaw;
+				else
+				{
+					PrintUsage();
+					return 1;
+				}
+			}
+		}
+		else if ( arg.size() > 0 && arg[0] == '-' )
+		{
+			PrintUsage();
+			return 1;
+		}
+		else files.push_back(arg);
+	}
+
+	if ( files.empty() || format == 0 ) {
+		PrintUsage();
+		return 1;
+	}
+	if ( nThreads < 1 ) nThreads = 1;
+	if ( nThreads > G4int(files.size()) ) nThreads = files.size();
+
+	// The grid is taken from the first dump, every other one must match it
+	RawHeader header;
+	{
+		std::ifstream in(files[0], std::ios::in | std::ios::binary);
+		if (!DetectorMatrix::ReadRawHeader(in, header))
+		{
+			G4cerr << "pddmerge: " << files[0] << " is not a raw dump" << G4endl;
+			return 1;
+		}
+	}
+
+	DetectorMatrix::parent_folder = folder;
+	DetectorMatrix::outputFormat = format;
+	DetectorMatrix* matrix = DetectorMatrix::GetInstance(header.nX, header.nY, header.nZ,
+			header.massOfVoxel, header.volumeOfVoxel, header.zEdges, header.radius);
+
+	// Every thread adds its share of the dumps to its own shard, the shards are
+	// then merged in thread order so the result does not depend on timing
+	std::vector<Share> shares(nThreads);
+	std::vector<std::thread> threads;
+	for (G4int t=0; t<nThreads; t++)
+	{
+		threads.push_back(std::thread(MergeFiles, std::cref(files), t, nThreads, &shares[t]));
+	}
+
+	G4bool ok = true;
+	for (G4int t=0; t<nThreads; t++)
+	{
+		threads[t].join();
+		ok = ok && shares[t].ok;
+		matrix -> Merge(shares[t].shard);
+		delete shares[t].shard;
+	}
+	if (!ok) return 1;
+
+	matrix -> SortSpecies();
+
+	G4cout << "pddmerge: " << files.size() << " runs, " << matrix->GetNumberOfEvents()
+			<< " events, writing to " << folder << G4endl;
+	return matrix -> Store() ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "Checkpoint.hh"
+#include "DetectorMatrix.hh"
+#include "OutputWriter.hh"
+#include "RunManifest.hh"
+
+// Geant4 Headers
+#include "G4AutoLock.hh"
+#include "G4Threading.hh"
+#include "Randomize.hh"
+
+// C++ Headers
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+
+G4long Checkpoint::everyEvents = 0;
+G4double Checkpoint::everyMinutes = 0.;
+G4String Checkpoint::filename = "data/checkpoint.bin";
+
+namespace
+{
+	G4Mutex checkpointMutex = G4MUTEX_INITIALIZER;
+
+	// Run in progress and its events, including the resumed ones
+	G4int currentRunID = 0;
+	G4long targetEvents = 0;
+
+	// Master event count and time of the next checkpoint
+	G4long nextEvents = 0;
+	G4double lastTime = 0.;
+
+	// Master event count of the next snapshot, snapshots of the run so far
+	G4long nextSnapshot = 0;
+	G4long snapshots = 0;
+
+	// Multi-threaded runs: seed of a resumed run, derived from the master
+	// engine state at the start of the run (the workers' engines cannot be
+	// saved consistently). 0 in sequential mode
+	G4long resumeSeed = 0;
+
+	// Order in which the files are queued for the writer, and the last
+	// checkpoint and snapshot it wrote (writer thread only)
+	G4long queuedFiles = 0;
+	G4long checkpointWritten = 0;
+	G4long snapshotWritten = 0;
+
+	// Worker shard flushing
+	G4ThreadLocal G4long eventsSinceFlush = 0;
+	G4ThreadLocal G4double lastFlushTime = -1.;
+
+	G4double Now()
+	{
+		return std::chrono::duration<G4double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Positive seed from an engine state (64-bit FNV-1a), without drawing from
+	// the engine, so the events of the run are not changed
+	G4long SeedOf(const std::string& state)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t c=0; c<state.size(); c++)
+		{
+			hash ^= (unsigned char)(state[c]);
+			hash *= 1099511628211ull;
+		}
+		G4long seed = G4long(hash & 0x7fffffffffffffffull);
+		return seed ? seed : 1;
+	}
+}
+
+void Checkpoint::BeginOfRun(G4int runID, G4long eventsToProcess)
+{
+	DetectorMatrix* master = DetectorMatrix::GetMasterInstance();
+	if (!master) return;
+
+	G4AutoLock lock(&checkpointMutex);
+	currentRunID = runID;
+	targetEvents = master->GetNumberOfEvents() + eventsToProcess;
+	nextEvents = master->GetNumberOfEvents() + everyEvents;
+	nextSnapshot = master->GetNumberOfEvents() + std::max(DetectorMatrix::snapshotEvery, G4long(1));
+	snapshots = 0;
+	lastTime = Now();
+
+	// The writer is created by the master, before the workers queue jobs on it
+	if (Enabled() || DetectorMatrix::snapshotEvery > 0) OutputWriter::GetInstance();
+
+	// The event seeds have not been drawn from the master engine yet
+	resumeSeed = 0;
+	if (G4Threading::IsMultithreadedApplication())
+	{
+		std::ostringstream engine;
+		G4Random::getTheEngine() -> put(engine);
+		resumeSeed = SeedOf(engine.str());
+	}
+}
+
+void Checkpoint::EndOfEvent(DetectorMatrix* matrix)
+{
+	G4long snapshotEvery = DetectorMatrix::snapshotEvery;
+	if ((!Enabled() && snapshotEvery <= 0) || !matrix) return;
+
+	DetectorMatrix* master = DetectorMatrix::GetMasterInstance();
+	G4double now = Now();
+
+	if (matrix != master)
+	{
+		// Worker: hand over the shard often enough for the master to reach
+		// the next checkpoint or snapshot, without waiting for the other workers
+		if (lastFlushTime < 0.) lastFlushTime = now;
+		eventsSinceFlush++;
+
+		G4long every = everyEvents;
+		if (snapshotEvery > 0 && (every <= 0 || snapshotEvery < every)) every = snapshotEvery;
+		G4long flushEvery = std::max(every / std::max(1, G4Threading::GetNumberOfRunningWorkerThreads()), G4long(1));
+
+		G4bool due = (every > 0 && eventsSinceFlush >= flushEvery)
+				|| (everyMinutes > 0. && now - lastFlushTime >= everyMinutes * 60.);
+		if (!due) return;
+
+		// The jobs are queued once the lock is released: this thread may wait
+		// for room in the writer queue, the other workers do not
+		std::vector<OutputWriter::Job> jobs;
+		{
+			G4AutoLock lock(&checkpointMutex, std::try_to_lock);
+			if (!lock.owns_lock()) return;
+
+			master -> Merge(matrix);
+			matrix -> Clear();
+			eventsSinceFlush = 0;
+			lastFlushTime = now;
+
+			WriteDue(master, now, jobs);
+		}
+		for (size_t j=0; j<jobs.size(); j++) OutputWriter::GetInstance() -> Submit(jobs[j]);
+		return;
+	}
+
+	// Sequential mode: the matrix of this thread is the master
+	std::vector<OutputWriter::Job> jobs;
+	{
+		G4AutoLock lock(&checkpointMutex);
+		WriteDue(master, now, jobs);
+	}
+	for (size_t j=0; j<jobs.size(); j++) OutputWriter::GetInstance() -> Submit(jobs[j]);
+}
+
+void Checkpoint::WriteDue(DetectorMatrix* master, G4double now, std::vector<OutputWriter::Job>& jobs)
+{
+	if ((everyEvents > 0 && master->GetNumberOfEvents() >= nextEvents)
+			|| (everyMinutes > 0. && now - lastTime >= everyMinutes * 60.))
+	{
+		// Sequential mode: the engine of this thread, which continues exactly
+		std::string state;
+		if (resumeSeed == 0)
+		{
+			std::ostringstream engine;
+			G4Random::getTheEngine() -> put(engine);
+			state = engine.str();
+		}
+
+		// The copy is written by the background writer. Workers may queue their
+		// jobs out of order, so a checkpoint older than the last one written is
+		// dropped
+		DetectorMatrix* copy = master -> Copy();
+		const G4long target = targetEvents;
+		const G4long seed = resumeSeed;
+		const G4String file = filename;
+		const G4long order = ++queuedFiles;
+		jobs.push_back([copy, state, target, seed, file, order]()
+		{
+			if (order > checkpointWritten)
+			{
+				checkpointWritten = order;
+				Write(copy, state, target, seed, file);
+			}
+			delete copy;
+		});
+
+		while (everyEvents > 0 && nextEvents <= master->GetNumberOfEvents()) nextEvents += everyEvents;
+		lastTime = now;
+	}
+
+	// The snapshot only reads the axis voxels and the species totals, the file
+	// is written in the background as well
+	G4long snapshotEvery = DetectorMatrix::snapshotEvery;
+	if (snapshotEvery > 0 && master->GetNumberOfEvents() >= nextSnapshot)
+	{
+		// The previous snapshot (.1) is an output of the run from the second one on
+		const G4String snapshot = master -> GetSnapshot();
+		const G4String file = DetectorMatrix::RunFilename(currentRunID, "Snapshot", ".out");
+		const G4int runID = currentRunID;
+		const G4bool rotated = (snapshots++ > 0);
+		const G4long order = ++queuedFiles;
+		jobs.push_back([snapshot, file, runID, rotated, order]()
+		{
+			if (order < snapshotWritten) return;
+			snapshotWritten = order;
+			if (!DetectorMatrix::StoreSnapshot(file, snapshot)) return;
+			RunManifest::AddOutput(runID, file);
+			if (rotated) RunManifest::AddOutput(runID, file + ".1");
+		});
+		while (nextSnapshot <= master->GetNumberOfEvents()) nextSnapshot += snapshotEvery;
+	}
+}
+
+// Checkpoint file (native byte order):
+//   char[6] "PDDCKP", uint16 version, int64 events of the run,
+//   int64 seed of the resumed run (version 3, 0: the engine state continues
+//   the run exactly), uint32 engine state length, engine state, raw matrix dump
+void Checkpoint::Write(const DetectorMatrix* matrix, const std::string& state,
+		G4long events, G4long seed, const G4String& file)
+{
+	const uint16_t version = 3;
+	const int64_t counts[2] = { events, seed };
+	const uint32_t stateLength = state.size();
+
+	G4String temporary = file + ".tmp";
+	std::ofstream out(temporary, std::ios::binary);
+	out.write("PDDCKP", 6);
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+	out.write(reinterpret_cast<const char*>(&stateLength), sizeof(stateLength));
+	out.write(state.data(), stateLength);
+	matrix -> WriteRaw(out);
+	out.close();
+
+	if (!out || std::rename(temporary.c_str(), file.c_str()) != 0)
+	{
+		G4ExceptionDescription msg;
+		msg << "Could not write the checkpoint " << file;
+		G4Exception("Checkpoint::Write()", "PDD1002", JustWarning, msg);
+		std::remove(temporary.c_str());
+	}
+	else
+	{
+		G4cout << "Checkpoint: " << matrix->GetNumberOfEvents() << " of " << events
+				<< " events written to " << file << G4endl;
+	}
+}
+
+G4String Checkpoint::EndOfRun()
+{
+	return Enabled() ? filename : G4String();
+}
+
+G4long Checkpoint::Resume(const G4String& file)
+{
+	DetectorMatrix* master = DetectorMatrix::GetMasterInstance();
+	if (!master) return -1;
+
+	std::ifstream in(file, std::ios::binary);
+	char magic[6];
+	uint16_t version = 0;
+	int64_t target = 0;
+	int64_t seed = 0;
+	uint32_t stateLength = 0;
+
+	// Version 1 checkpoints always hold the engine of the thread which wrote
+	// them. Version 2 ones hold the number of events seeded from the engine
+	// state instead of a seed, which is then derived from the state
+	if (!in.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != "PDDCKP"
+			|| !in.read(reinterpret_cast<char*>(&version), sizeof(version)) || version < 1 || version > 3
+			|| !in.read(reinterpret_cast<char*>(&target), sizeof(target))
+			|| (version > 1 && !in.read(reinterpret_cast<char*>(&seed), sizeof(seed)))
+			|| !in.read(reinterpret_cast<char*>(&stateLength), sizeof(stateLength)))
+	{
+		return -1;
+	}
+
+	std::string state(stateLength, ' ');
+	if (stateLength && !in.read(&state[0], stateLength)) return -1;
+	if (version == 2 && seed > 0) seed = SeedOf(state);
+
+	master -> Clear();
+	if (!master -> ReadRaw(in))
+	{
+		master -> Clear();
+		return -1;
+	}
+
+	// Multi-threaded checkpoint: a new seed, so the resumed events are not the
+	// ones the run manager seeded for the interrupted run, whatever its seeding
+	if (seed > 0)
+	{
+		G4Random::setTheSeed(seed);
+	}
+	else
+	{
+		std::istringstream engine(state);
+		G4Random::getTheEngine() -> get(engine);
+	}
+
+	G4long remaining = std::max(target - master->GetNumberOfEvents(), int64_t(0));
+	if (remaining > 0) RunManifest::SetResume(file, master->GetNumberOfEvents(), target, seed);
+	return remaining;
+}
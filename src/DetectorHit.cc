@@ -15,107 +15,47 @@
  *
  */
 
+
 // PDD1 Headers
 #include "DetectorHit.hh"
 
 // Geant4 Headers
 #include "G4UnitsTable.hh"
-#include "G4VVisManager.hh"
-#include "G4Circle.hh"
-#include "G4Colour.hh"
-#include "G4VisAttributes.hh"
+#include "G4Material.hh"
 
 // C++ Headers
 #include <iomanip>
 
-G4ThreadLocal G4Allocator<DetectorHit>* PDD1HitAllocator=0;
-
-DetectorHit::DetectorHit()
-: G4VHit(),
-  fTrackID(-1),
-  fix(-1),
-  fiy(-1),
-  fiz(-1),
-  fEDep(0.),
-  fSecondariesEDep(0.),
-  fDX(0.),
-  fKinEMean(0.),
-  fPos(G4ThreeVector()),
-  fParticleDef(0),
-  fMat(0),
-  fVol(0.)
-{}
-
-DetectorHit::~DetectorHit()
-{}
-
-DetectorHit::DetectorHit(const DetectorHit& right)
-: G4VHit()
+void DetectorHit::Print() const
 {
-	fTrackID			= right.fTrackID;
-	fix					= right.fix;
-	fiy					= right.fiy;
-	fiz					= right.fiz;
-	fEDep				= right.fEDep;
-	fSecondariesEDep	= right.fSecondariesEDep;
-	fDX					= right.fDX;
-	fKinEMean			= right.fKinEMean;
-	fPos				= right.fPos;
-	fParticleDef		= right.fParticleDef;
-	fMat				= right.fMat;
-	fVol				= right.fVol;
+	G4cout
+	<< "TrackID: " << std::setw(3) << trackID << " "
+	<< "Voxel: " << std::setw(7) << voxel << " "
+	<< "Species: " << std::setw(3) << speciesID << " "
+	<< "Edep: " << std::setw(7) << G4BestUnit(eDep,"Energy") << " "
+	<< "DX: " << std::setw(7) << G4BestUnit(dx,"Length") << " "
+	<< "KinEMean: " << std::setw(7) << G4BestUnit(kinEMean,"Energy") << " "
+	<< "Mat: " << std::setw(7) << (*G4Material::GetMaterialTable())[materialID]->GetName()
+	<< G4endl;
 }
 
-const DetectorHit& DetectorHit::operator=(const DetectorHit& right)
-{
-	fTrackID			= right.fTrackID;
-	fix					= right.fix;
-	fiy					= right.fiy;
-	fiz					= right.fiz;
-	fEDep				= right.fEDep;
-	fSecondariesEDep	= right.fSecondariesEDep;
-	fDX					= right.fDX;
-	fKinEMean			= right.fKinEMean;
-	fPos				= right.fPos;
-	fParticleDef		= right.fParticleDef;
-	fMat				= right.fMat;
-	fVol				= right.fVol;
-
-	return *this;
-}
+PDD1HitsCollection::PDD1HitsCollection(const G4String& detName, const G4String& colName,
+		const std::vector<DetectorHit>* hits)
+: G4VHitsCollection(detName, colName),
+  fHits(hits)
+{}
 
-G4bool DetectorHit::operator==(const DetectorHit& right) const
-								{
-	return ( this == &right ) ? true : false;
-								}
+PDD1HitsCollection::~PDD1HitsCollection()
+{}
 
-void DetectorHit::Draw()
+void PDD1HitsCollection::Keep()
 {
-	G4VVisManager* pVVisManager = G4VVisManager::GetConcreteInstance();
-	if(pVVisManager)
-	{
-		G4Circle circle(fPos);
-		circle.SetScreenSize(4.);
-		circle.SetFillStyle(G4Circle::filled);
-		G4Colour colour(1.,0.,0.);
-		G4VisAttributes attribs(colour);
-		circle.SetVisAttributes(attribs);
-		pVVisManager->Draw(circle);
-	}
+	if (fHits == &fKeptHits) return;
+	fKeptHits = *fHits;
+	fHits = &fKeptHits;
 }
 
-void DetectorHit::Print()
+void PDD1HitsCollection::PrintAllHits()
 {
-	G4cout
-	<< "TrackID: " << std::setw(3) << fTrackID << " "
-	<< "ix: " << std::setw(3) << fix << " "
-	<< "iy: " << std::setw(3) << fiy << " "
-	<< "iz: " << std::setw(3) << fiz << " "
-	<< "Edep: " << std::setw(7) << G4BestUnit(fEDep,"Energy") << " "
-	<< "SecondariesEdep: " << std::setw(7) << G4BestUnit(fSecondariesEDep,"Energy") << " "
-	<< "KinEMean: " << std::setw(7) << G4BestUnit(fKinEMean,"Energy") << " "
-	<< "Position: " << std::setw(7) << G4BestUnit( fPos,"Length")
-	<< "ParticleName: " << std::setw(7) << fParticleDef->GetParticleName()
-	<< "Mat: " << std::setw(7) << fMat->GetName()
-	<< G4endl;
+	for (size_t h=0; h<fHits->size(); h++) (*fHits)[h].Print();
 }
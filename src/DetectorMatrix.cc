@@ -26,7 +26,7 @@
 #include "G4SystemOfUnits.hh"
 #include "G4RunManager.hh"
 #include "G4Run.hh"
-#include "G4EmCalculator.hh"
+#include "G4AutoLock.hh"
 
 // C++ Headers
 #include <time.h>
@@ -35,28 +35,244 @@
 #include <sstream>
 #include <iomanip>
 #include <array>
-
-DetectorMatrix* DetectorMatrix::instance = NULL;
+#include <cstdio>
+#ifdef PDD1_USE_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+#include <stdint.h>
+#include <algorithm>
+#include <filesystem>
+
+G4ThreadLocal DetectorMatrix* DetectorMatrix::instance = NULL;
+DetectorMatrix* DetectorMatrix::masterInstance = NULL;
+std::vector<std::pair<G4int, DetectorMatrix*> > DetectorMatrix::pendingShards;
+G4int DetectorMatrix::generation = 0;
 G4bool DetectorMatrix::secondary = true;
 G4String DetectorMatrix::parent_folder = "data";
+VoxelAccumulator::Storage DetectorMatrix::storage = VoxelAccumulator::kDense;
+VoxelAccumulator::Layout DetectorMatrix::layout = VoxelAccumulator::kPlanar;
+G4int DetectorMatrix::outputFormat = DetectorMatrix::kAscii;
+G4bool DetectorMatrix::compressOutput = false;
+G4long DetectorMatrix::snapshotEvery = 0;
+G4bool DetectorMatrix::runDirectories = true;
+
+namespace
+{
+G4Mutex shardMutex = G4MUTEX_INITIALIZER;
+
+// Output folder of this job and the parent_folder it was made in
+G4Mutex jobFolderMutex = G4MUTEX_INITIALIZER;
+G4String jobParent;
+G4String jobFolder;
+
+// Name, unit and normalisation of the stored quantities (see OutputQuantity)
+struct OutputQuantityInfo
+{
+	const char* name;
+	const char* unitName;
+	G4double unit;
+	G4bool perEvent;
+};
+
+const OutputQuantityInfo outputQuantities[DetectorMatrix::kNOutputQuantities] =
+{
+		{ "Edep", "MeV", MeV, true },
+		{ "Let", "keV/um", keV/um, false },
+		{ "Fluence", "1/cm2", 1./cm2, true }
+};
+
+// Buffered text output: numbers are formatted in place and the file is
+// written in large blocks instead of line by line
+class AsciiTable
+{
+public:
+	AsciiTable() { fBuffer.reserve(kBufferSize + 64); }
+	~AsciiTable() { Close(); }
+
+	G4bool Open(const G4String& filename)
+	{
+		fOut.open(filename, std::ios::out);
+		if (!fOut.is_open())
+		{
+			G4Exception("DetectorMatrix::StoreAscii()", "PDD1002", JustWarning,
+					("Cannot open " + filename).c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void Append(char c) { fBuffer += c; }
+	void Append(const std::string& text) { fBuffer += text; }
+
+	// Non-negative voxel indices
+	void Append(G4int value)
+	{
+		char digits[16];
+		G4int n = 0;
+		do { digits[n++] = char('0' + value % 10); value /= 10; } while (value > 0);
+		while (n > 0) fBuffer += digits[--n];
+	}
+
+	// Same text as std::ostream << value with the default precision (%.6g)
+	void Append(G4double value)
+	{
+		char text[32];
+#ifdef __cpp_lib_to_chars
+		std::to_chars_result result = std::to_chars(text, text + sizeof(text), value, std::chars_format::general, 6);
+		fBuffer.append(text, result.ptr - text);
+#else
+		G4int n = std::snprintf(text, sizeof(text), "%.6g", value);
+		fBuffer.append(text, n);
+#endif
+		if (fBuffer.size() >= kBufferSize) Flush();
+	}
+
+	void Flush()
+	{
+		if (fOut.is_open() && !fBuffer.empty()) fOut.write(fBuffer.data(), fBuffer.size());
+		fBuffer.clear();
+	}
+
+	// False if the table could not be written completely
+	G4bool Close()
+	{
+		if (!fOut.is_open()) return false;
+		Flush();
+		fOut.close();
+		return !fOut.fail();
+	}
+
+private:
+	static const size_t kBufferSize = 1 << 22;
+	std::string fBuffer;
+	std::ofstream fOut;
+};
+
+// Binary output file, gzip compressed on request when zlib is available
+class BinaryFile
+{
+public:
+	BinaryFile() : fGzFile(0) {}
+	~BinaryFile() { Close(); }
+
+	G4bool Open(const G4String& filename, G4bool compress)
+	{
+#ifdef PDD1_USE_ZLIB
+		if (compress) fGzFile = gzopen(filename.c_str(), "wb");
+		else
+#endif
+		fOut.open(filename, std::ios::out | std::ios::binary);
+
+		if (!fGzFile && !fOut.is_open())
+		{
+			G4Exception("DetectorMatrix::StoreCoo()", "PDD1002", JustWarning,
+					("Cannot open " + filename).c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void Write(const void* data, size_t size)
+	{
+#ifdef PDD1_USE_ZLIB
+		if (fGzFile)
+		{
+			// gzwrite takes an unsigned int length
+			const char* bytes = static_cast<const char*>(data);
+			while (size > 0)
+			{
+				unsigned int block = (size > (1u << 30)) ? (1u << 30) : unsigned(size);
+				gzwrite(static_cast<gzFile>(fGzFile), bytes, block);
+				bytes += block;
+				size -= block;
+			}
+			return;
+		}
+#endif
+		fOut.write(static_cast<const char*>(data), size);
+	}
+
+	// False if the file could not be written completely
+	G4bool Close()
+	{
+		G4bool written = true;
+#ifdef PDD1_USE_ZLIB
+		if (fGzFile) written = (gzclose(static_cast<gzFile>(fGzFile)) == Z_OK);
+#endif
+		fGzFile = 0;
+		if (fOut.is_open())
+		{
+			fOut.close();
+			written = !fOut.fail();
+		}
+		return written;
+	}
+
+private:
+	void* fGzFile;
+	std::ofstream fOut;
+};
 
+// Quote a string for JSON
+std::string JsonString(const G4String& value)
+{
+	std::string quoted = "\"";
+	for (size_t c=0; c<value.size(); c++)
+	{
+		if (value[c] == '"' || value[c] == '\\') quoted += '\\';
+		quoted += value[c];
+	}
+	return quoted + "\"";
+}
+}
 
-// Only return a pointer to matrix
+// Return a pointer to the matrix of the calling thread.
+// The master thread gets the master instance; every worker thread gets its own
+// shard with the master segmentation, so the fill methods never need a lock.
 DetectorMatrix* DetectorMatrix::GetInstance()
 {
+	if (masterInstance && instance != masterInstance
+			&& (!instance || instance->fGeneration != generation))
+	{
+		delete instance;
+		instance = new DetectorMatrix(masterInstance->fNX, masterInstance->fNY, masterInstance->fNZ,
+				masterInstance->fMassOfVoxel, masterInstance->fVolumeOfVoxel, masterInstance->fZEdges,
+				masterInstance->fRadius);
+		instance -> Initialize();
+	}
 	return instance;
 }
 
 // TODO A check on the parameters is required!
-DetectorMatrix* DetectorMatrix::GetInstance(G4int voxelX, G4int voxelY, G4int voxelZ, G4double mass)
+DetectorMatrix* DetectorMatrix::GetInstance(G4int voxelX, G4int voxelY, G4int voxelZ, G4double mass, G4double volume,
+		const std::vector<G4double>& zEdges, G4double radius)
 {
-	if (instance) delete instance;
-	instance = new DetectorMatrix(voxelX, voxelY, voxelZ, mass);
-	instance -> Initialize();
+	if (masterInstance) delete masterInstance;
+	generation++;
+	masterInstance = new DetectorMatrix(voxelX, voxelY, voxelZ, mass, volume, zEdges, radius);
+	masterInstance -> Initialize();
+
+	G4cout << "DetectorMatrix: Memory space to store physical variables into " <<
+			voxelX*voxelY*voxelZ <<
+			" voxels has been allocated " << G4endl;
+
+	instance = masterInstance;
 	return instance;
 }
 
-DetectorMatrix::DetectorMatrix(G4int voxelX, G4int voxelY, G4int voxelZ, G4double mass)
+void DetectorMatrix::DeleteInstance()
+{
+	if (instance != masterInstance) delete instance;
+	instance = NULL;
+}
+
+DetectorMatrix::DetectorMatrix(G4int voxelX, G4int voxelY, G4int voxelZ, G4double mass, G4double volume,
+		const std::vector<G4double>& zEdges, G4double radius)
 {
 	// Number of the voxels of the phantom
 	// For Y = Z = 1 the phantom is divided in slices (and not in voxels)
@@ -65,23 +281,44 @@ DetectorMatrix::DetectorMatrix(G4int voxelX, G4int voxelY, G4int voxelZ, G4doubl
 	fNY = voxelY;
 	fNZ = voxelZ;
 	fMassOfVoxel = mass;
+	fVolumeOfVoxel = volume;
+	fNumberOfEvents = 0;
 
-	G4cout << "DetectorMatrix: Memory space to store physical variables into " <<
-			fNX*fNY*fNZ <<
-			" voxels has been allocated " << G4endl;
-
-
-	// Hit voxel (TrackID) marker
-	// This array mark the status of voxel, if a hit occur, with the trackID of the particle
-	// Must be initialized
+	// Non-uniform depth bins: the voxel volume scales with the bin thickness
+	fVolumeOfSlice.assign(fNZ, fVolumeOfVoxel);
+	if (zEdges.size() == size_t(fNZ) + 1)
+	{
+		fZEdges = zEdges;
+		G4double meanThickness = (fZEdges.back() - fZEdges.front()) / fNZ;
+		for (G4int k = 0; k < fNZ; k++)
+			fVolumeOfSlice[k] = fVolumeOfVoxel * (fZEdges[k+1] - fZEdges[k]) / meanThickness;
+	}
 
-	hitTrack = new G4int[fNX*fNY*fNZ];
-	ClearHitTrack();
+	// Cylindrical grid: equal radial bins, the area of ring i is (2i+1)/nX
+	// times the mean one
+	fRadius = radius;
+	fRingScale.assign(fNX, 1.);
+	if (fRadius > 0.)
+	{
+		for (G4int i = 0; i < fNX; i++) fRingScale[i] = (2. * i + 1.) / fNX;
+	}
+	fGeneration = generation;
+
+	// Output settings at creation time (a snapshot keeps those of its run)
+	fRunID = 0;
+	fOutputFolder = parent_folder;
+	fRunDirectory = runDirectories;
+	fOutputFormat = outputFormat;
+	fSecondary = secondary;
+#ifdef PDD1_USE_ZLIB
+	fCompress = compressOutput;
+#else
+	fCompress = false;
+#endif
 }
 
 DetectorMatrix::~DetectorMatrix()
 {
-	delete[] hitTrack;
 	Clear();
 }
 
@@ -89,12 +326,12 @@ void DetectorMatrix::Clear()
 {
 	for (size_t i=0; i<ionStore.size(); i++)
 	{
-		delete[] ionStore[i].eDep;
-		delete[] ionStore[i].letN;
-		delete[] ionStore[i].letD;
-		delete[] ionStore[i].fluence;
+		delete ionStore[i].data;
 	}
 	ionStore.clear();
+	fSpeciesIndex.clear();
+	fNumberOfEvents = 0;
+	fStoppingPower.ResetVerification();
 }
 
 // Initialize the elements of the matrix to zero
@@ -112,386 +349,772 @@ void DetectorMatrix::PrintNuclides()
 	{
 		G4cout << ionStore[i].name << G4endl;
 	}
+	G4cout << "DetectorMatrix: " << ionStore.size() << " species use "
+			<< GetMemoryUsage()/1048576. << " MB" << G4endl;
 }
 
-// Clear Hit voxel (TrackID) markers
-void DetectorMatrix::ClearHitTrack()
+size_t DetectorMatrix::GetMemoryUsage() const
 {
-	for(G4int i=0; i<fNX*fNY*fNZ; i++) hitTrack[i] = 0;
+	size_t memory = 0;
+	for (size_t i=0; i<ionStore.size(); i++)
+	{
+		memory += ionStore[i].data -> GetMemoryUsage();
+	}
+	return memory;
 }
 
-// Return Hit status
-G4int* DetectorMatrix::GetHitTrack(G4int i, G4int j, G4int k)
+// Queue this worker shard; the master merges it in EndOfRunAction
+void DetectorMatrix::ScheduleMerge()
 {
-	return &(hitTrack[Index(i,j,k)]);
+	G4AutoLock lock(&shardMutex);
+	pendingShards.push_back(std::make_pair(G4Threading::G4GetThreadId(), this));
 }
 
-// General method to store matrix data to filename
-void DetectorMatrix::StoreAscii(G4String filename, G4double** data,G4double unit, G4double scale=1.0)
+// Merge all the worker shards of this run into the master.
+// Shards are merged in thread order and species are sorted afterwards, so the
+// result does not depend on which worker finished first.
+void DetectorMatrix::MergeShards()
 {
+	G4AutoLock lock(&shardMutex);
 
-	//std::sort(ionStore.begin(), ionStore.end());
+	std::sort(pendingShards.begin(), pendingShards.end());
 
-	if(data)
+	for (size_t s=0; s<pendingShards.size(); s++)
 	{
-		ofs.open(filename, std::ios::out);
-		if (ofs.is_open())
-		{
-			// Write the voxels index and the list of particles/ions
-			ofs << "i" << '\t' << "j" << '\t' << "k";
-			ofs <<'\t' << "Total";
+		DetectorMatrix* shard = pendingShards[s].second;
+		if (shard == this) continue;
+		Merge(shard);
+		shard -> Clear();
+	}
+	pendingShards.clear();
 
-			if (secondary)
-			{
-				for (size_t l=0; l < ionStore.size(); l++)
-				{
-					G4String a = (ionStore[l].isPrimary) ? "_1":"";     // is it a primary?
-					// Total dose
-					ofs <<'\t' <<ionStore[l].name + a;
-				}
-			}
+	SortSpecies();
 
-			// Write data
-			for(G4int i = 0; i < fNX; i++)
-				for(G4int j = 0; j < fNY; j++)
-					for(G4int k = 0; k < fNZ; k++)
-					{
+	if (StoppingPowerTable::verifyEvery > 0)
+	{
+		fStoppingPower.PrintVerification();
+		fStoppingPower.ResetVerification();
+	}
+}
 
-						G4int n = Index(i, j, k);
-						G4double** pdata = (G4double**) data;
+void DetectorMatrix::Merge(const DetectorMatrix* shard)
+{
+	for (size_t ls=0; ls < shard->ionStore.size(); ls++)
+	{
+		const ion& src = shard->ionStore[ls];
 
-						G4double total=0;
+		// Search for already allocated data...
+		G4int l;
+		std::unordered_map<G4long, G4int>::const_iterator it = fSpeciesIndex.find(SpeciesKey(src.PDGencoding, src.isPrimary));
+		if (it != fSpeciesIndex.end()) l = it->second;
+		else l = AddSpecies(NewIon(src.isPrimary, src.PDGencoding, src.name, src.Z, src.A, src.particleDef, src.hasLet));
 
-						for (size_t l=0; l < ionStore.size(); l++)
-						{
-							if (pdata[l][n])
-							{
-								total+=pdata[l][n];
-							}
-						}
+		ionStore[l].data -> Merge(*src.data);
+		if (!ionStore[l].particleDef) ionStore[l].particleDef = src.particleDef;
+	}
 
-						if(total){
-							ofs << G4endl;
-							ofs << i << '\t' << j << '\t' << k;
-							ofs << '\t' << total*scale/unit;
-
-							if (secondary)
-							{
-								for (size_t l=0; l < ionStore.size(); l++)
-								{
-									ofs << '\t' << pdata[l][n]*scale/unit;
-								}
-							}
-						}
+	fNumberOfEvents += shard->fNumberOfEvents;
+	fStoppingPower.MergeVerification(shard->fStoppingPower);
+}
 
-					}
-			ofs.close();
-		}
+void DetectorMatrix::SortSpecies()
+{
+	std::sort(ionStore.begin(), ionStore.end(), [](const ion& a, const ion& b)
+	{
+		if (a.isPrimary != b.isPrimary) return a.isPrimary;
+		if (a.Z != b.Z) return a.Z < b.Z;
+		if (a.A != b.A) return a.A < b.A;
+		return a.PDGencoding < b.PDGencoding;
+	});
+
+	// Species ids follow the new order
+	fSpeciesIndex.clear();
+	for (size_t l=0; l < ionStore.size(); l++)
+	{
+		fSpeciesIndex[SpeciesKey(ionStore[l].PDGencoding, ionStore[l].isPrimary)] = l;
 	}
 }
 
-// General method to store matrix data to filename
-void DetectorMatrix::StoreAscii(G4String filename, G4int** data,G4double unit, G4double scale)
+// Allocate a new species store with all the elements initialized to zero
+ion DetectorMatrix::NewIon(G4bool isPrimary, G4int PDGencoding, const G4String& name, G4int Z, G4int A, const G4ParticleDefinition* particleDef, G4bool hasLet)
 {
+	ion newIon =
+	{
+			isPrimary,
+			PDGencoding,
+			name,
+			name.length(),
+			Z,
+			A,
+			particleDef,
+			hasLet,
+			new VoxelAccumulator(fNX, fNY, fNZ, storage, layout)
+	};
 
-	//std::sort(ionStore.begin(), ionStore.end());
+	return newIon;
+}
+
+// Store the energy deposit, LET and fluence tables (Edep.out, Let.out, Fluence.out)
+// in a single pass over the voxels. Rows are only written for voxels with a
+// non-zero total; values are printed like std::ostream does (%.6g).
+G4bool DetectorMatrix::StoreAscii()
+{
+	AsciiTable tables[kNOutputQuantities];
 
-	if(data)
+	for (G4int q=0; q<kNOutputQuantities; q++)
 	{
-		ofs.open(filename, std::ios::out);
-		if (ofs.is_open())
-		{
-			// Write the voxels index and the list of particles/ions
-			ofs << "i" << '\t' << "j" << '\t' << "k";
-			ofs <<'\t' << "Total";
+		if (!tables[q].Open(OutputFilename(outputQuantities[q].name, ".out"))) return false;
+
+		// Write the voxels index and the list of particles/ions
+		tables[q].Append("i\tj\tk\tTotal");
 
-			if (secondary)
+		if (fSecondary)
+		{
+			for (size_t l=0; l < ionStore.size(); l++)
 			{
-				for (size_t l=0; l < ionStore.size(); l++)
-				{
-					G4String a = (ionStore[l].isPrimary) ? "_1":"";     // is it a primary?
-					// Total dose
-					ofs <<'\t' <<ionStore[l].name + a;
-				}
+				tables[q].Append('\t');
+				tables[q].Append(ionStore[l].name);
+				if (ionStore[l].isPrimary) tables[q].Append("_1");     // is it a primary?
 			}
+		}
+	}
+
+	std::vector<G4double> values(ionStore.size());
 
-			// Write data
-			for(G4int i = 0; i < fNX; i++)
-				for(G4int j = 0; j < fNY; j++)
-					for(G4int k = 0; k < fNZ; k++)
+	// Write data
+	for(G4int i = 0; i < fNX; i++)
+		for(G4int j = 0; j < fNY; j++)
+			for(G4int k = 0; k < fNZ; k++)
+				for (G4int q=0; q<kNOutputQuantities; q++)
+				{
+					G4double total = 0.;
+					for (size_t l=0; l < ionStore.size(); l++)
 					{
+						values[l] = GetRawOutputValue(l, q, i, j, k);
+						total += values[l];
+					}
 
-						G4int n = Index(i, j, k);
-						G4int** pdata = (G4int**) data;
+					if (total == 0.) continue;
 
-						G4int total=0;
+					AsciiTable& table = tables[q];
+					table.Append('\n');
+					table.Append(i);
+					table.Append('\t');
+					table.Append(j);
+					table.Append('\t');
+					table.Append(k);
+					table.Append('\t');
+					table.Append(Normalise(q, total));
 
+					if (fSecondary)
+					{
 						for (size_t l=0; l < ionStore.size(); l++)
 						{
-							if (pdata[l][n])
-							{
-								total+=pdata[l][n];
-							}
+							table.Append('\t');
+							table.Append(Normalise(q, values[l]));
 						}
-
-						if(total){
-							ofs << G4endl;
-							ofs << i << '\t' << j << '\t' << k;
-							ofs << '\t' << G4double(total)*scale/unit;
-
-							if (secondary)
-							{
-								for (size_t l=0; l < ionStore.size(); l++)
-								{
-									ofs << '\t' << G4double(pdata[l][n])*scale/unit;
-								}
-							}
-						}
-
 					}
-			ofs.close();
-		}
+				}
+
+	G4bool stored = true;
+	for (G4int q=0; q<kNOutputQuantities; q++)
+	{
+		if (tables[q].Close()) fStoredFiles.push_back(OutputFilename(outputQuantities[q].name, ".out"));
+		else stored = false;
 	}
+	return stored;
 }
 
-void DetectorMatrix::StoreEDepAscii()
+// True if every output was written
+G4bool DetectorMatrix::Store()
 {
+	G4bool stored = true;
+	fStoredFiles.clear();
 
-	G4int nEvents = G4RunManager::GetRunManager()->GetCurrentRun()->GetNumberOfEventToBeProcessed() ;
+	if (fOutputFormat & kAscii) stored = StoreAscii() && stored;
 
-	auto eDep = new G4double*[ionStore.size()];
+	if (fOutputFormat & kNpy) stored = StoreNpy() && stored;
 
-	for (size_t l=0; l < ionStore.size(); l++){
-		eDep[l] = new G4double[fNX*fNY*fNZ];
-	}
+	if (fOutputFormat & kCoo) stored = StoreCoo() && stored;
 
-	for(G4int i = 0; i < fNX; i++)
-		for(G4int j = 0; j < fNY; j++)
-			for(G4int k = 0; k < fNZ; k++)
-			{
-				G4int n = Index(i, j, k);
-				for (size_t l=0; l < ionStore.size(); l++){
-					eDep[l][n]=ionStore[l].eDep[n];
-				}
-			}
+	if (fOutputFormat & kRaw) stored = StoreRaw() && stored;
+
+	// The description also carries the depth bin edges and the cylindrical
+	// grid the ASCII tables lack
+	if ((fOutputFormat & (kNpy | kCoo)) || !fZEdges.empty() || IsCylindrical())
+		stored = StoreDescription() && stored;
+
+	if (!stored)
+	{
+		G4Exception("DetectorMatrix::Store()", "PDD1002", JustWarning,
+				("Some outputs could not be written to " + fOutputFolder).c_str());
+	}
+	return stored;
+}
 
-	StoreAscii(parent_folder+"/"+"Edep.out", eDep,MeV, 1./nEvents);
+// Output file name. Without run directories the first run keeps the plain
+// names and later runs get a _run<ID> suffix
+G4String DetectorMatrix::OutputFilename(const G4String& name, const G4String& extension) const
+{
+	std::ostringstream filename;
+	filename << fOutputFolder << "/" << name;
+	if (fRunID > 0 && !fRunDirectory) filename << "_run" << fRunID;
+	filename << extension;
+	return filename.str();
 }
 
-void DetectorMatrix::StoreLetAscii()
+// Output folder of this job: parent_folder/job<N>, with the first N free
+G4String DetectorMatrix::JobFolder()
 {
-	auto let = new G4double*[ionStore.size()];
+	G4AutoLock lock(&jobFolderMutex);
+	if (!jobFolder.empty() && jobParent == parent_folder) return jobFolder;
+
+	std::error_code error;
+	std::filesystem::create_directories(std::string(parent_folder), error);
 
-	for (size_t l=0; l < ionStore.size(); l++){
-		let[l] = new G4double[fNX*fNY*fNZ];
+	// create_directory does not take an existing folder, so jobs started at
+	// the same time still get different ones
+	jobFolder = parent_folder;
+	for (G4int n = 0; ; n++)
+	{
+		std::ostringstream folder;
+		folder << parent_folder << "/job" << n;
+		if (std::filesystem::create_directory(folder.str(), error))
+		{
+			jobFolder = folder.str();
+			break;
+		}
+		if (error)
+		{
+			G4Exception("DetectorMatrix::JobFolder()", "PDD1002", JustWarning,
+					("Cannot create a job folder in " + parent_folder).c_str());
+			break;
+		}
 	}
+	jobParent = parent_folder;
 
-	for(G4int i = 0; i < fNX; i++)
-		for(G4int j = 0; j < fNY; j++)
-			for(G4int k = 0; k < fNZ; k++)
-			{
-				G4int n = Index(i, j, k);
-				for (size_t l=0; l < ionStore.size(); l++){
-					if (ionStore[l].letD[n]>0.){
-						let[l][n]=ionStore[l].letN[n]/ionStore[l].letD[n];
-					}
-					else{
-						let[l][n]=0.;
-					};
-				}
-			}
+	G4cout << "DetectorMatrix: the outputs of this job are written to " << jobFolder << G4endl;
+	return jobFolder;
+}
+
+// Output folder of a run: parent_folder/job<N>/run<ID>, or parent_folder itself
+G4String DetectorMatrix::RunFolder(G4int runID)
+{
+	if (!runDirectories) return parent_folder;
 
-	StoreAscii(parent_folder+"/"+"Let.out", let,keV/um, 1.0);
+	std::ostringstream folder;
+	folder << JobFolder() << "/run" << runID;
+	return folder.str();
 }
 
-void DetectorMatrix::StoreFluenceAscii()
+// Output file name of a run, for the outputs not written by the matrix
+G4String DetectorMatrix::RunFilename(G4int runID, const G4String& name, const G4String& extension)
 {
+	std::ostringstream filename;
+	filename << RunFolder(runID) << "/" << name;
+	if (runID > 0 && !runDirectories) filename << "_run" << runID;
+	filename << extension;
+	return filename.str();
+}
 
-	G4int nEvents = G4RunManager::GetRunManager()->GetCurrentRun()->GetNumberOfEventToBeProcessed() ;
-	auto fluence = new G4double*[ionStore.size()];
+// Species name used in file names, with _1 for primaries
+G4String DetectorMatrix::SpeciesLabel(size_t l) const
+{
+	return ionStore[l].name + ((ionStore[l].isPrimary) ? "_1":"");
+}
 
-	for (size_t l=0; l < ionStore.size(); l++){
-		fluence[l] = new G4double[fNX*fNY*fNZ];
-	}
+G4String DetectorMatrix::NpyFilename(size_t l, G4int quantity) const
+{
+	return OutputFilename(G4String(outputQuantities[quantity].name) + "_" + SpeciesLabel(l), ".npy");
+}
 
-	for(G4int i = 0; i < fNX; i++)
-		for(G4int j = 0; j < fNY; j++)
-			for(G4int k = 0; k < fNZ; k++)
-			{
-				G4int n = Index(i, j, k);
-				for (size_t l=0; l < ionStore.size(); l++){
-					fluence[l][n]=ionStore[l].fluence[n];
-				}
-			}
+G4String DetectorMatrix::CooFilename(size_t l) const
+{
+	return OutputFilename(SpeciesLabel(l), fCompress ? ".coo.gz" : ".coo");
+}
 
-	StoreAscii(parent_folder+"/"+"Fluence.out", fluence,(1./cm2), (1/nEvents));
+// Move the data of the master into a new matrix, which can be stored while the
+// master accumulates the next run
+DetectorMatrix* DetectorMatrix::Detach(G4int runID)
+{
+	DetectorMatrix* snapshot = new DetectorMatrix(fNX, fNY, fNZ, fMassOfVoxel, fVolumeOfVoxel, fZEdges, fRadius);
+	snapshot->fRunID = runID;
+	snapshot->fOutputFolder = RunFolder(runID);
+	snapshot->fNumberOfEvents = fNumberOfEvents;
+	snapshot->ionStore.swap(ionStore);
+	snapshot->fSpeciesIndex.swap(fSpeciesIndex);
+
+	Clear();
+	return snapshot;
 }
 
-G4bool DetectorMatrix::FillEdep(G4int i, G4int j, G4int k, G4double energyDeposit, G4int trackID, G4ParticleDefinition* particleDef){
+DetectorMatrix* DetectorMatrix::Copy() const
+{
+	DetectorMatrix* copy = new DetectorMatrix(fNX, fNY, fNZ, fMassOfVoxel, fVolumeOfVoxel, fZEdges, fRadius);
+	copy->fRunID = fRunID;
+	copy->fOutputFolder = fOutputFolder;
+	copy -> Merge(this);
+	return copy;
+}
 
-	// Get Particle Data Group particle ID
-	G4int PDGencoding = particleDef -> GetPDGEncoding();
-	PDGencoding -= PDGencoding%10;
+G4double DetectorMatrix::GetRawOutputValue(size_t l, G4int quantity, G4int i, G4int j, G4int k) const
+{
+	const VoxelAccumulator* data = ionStore[l].data;
+	G4double value;
 
-	// Search for already allocated data...
-	for (size_t l=0; l < ionStore.size(); l++)
+	if (quantity == kLetOutput)
+	{
+		// Dose averaged LET
+		G4double letD = data->Get(VoxelAccumulator::kLetD, i, j, k);
+		value = (letD > 0.) ? data->Get(VoxelAccumulator::kLetN, i, j, k)/letD : 0.;
+	}
+	else
 	{
-		if (ionStore[l].PDGencoding == PDGencoding )
-		{   // Is it a primary or a secondary particle?
+		value = data->Get(quantity == kEDepOutput ? VoxelAccumulator::kEDep : VoxelAccumulator::kFluence, i, j, k);
+	}
 
-			if ( (trackID ==1 && ionStore[l].isPrimary) || (trackID !=1 && !ionStore[l].isPrimary))
-			{
+	return value;
+}
 
-				// Fill a matrix per each ion with the fluence
+G4double DetectorMatrix::Normalise(G4int quantity, G4double value) const
+{
+	if (outputQuantities[quantity].perEvent)
+	{
+		G4double nEvents = (fNumberOfEvents > 0) ? fNumberOfEvents : 1;
+		value *= 1./nEvents;
+	}
 
-				ionStore[l].eDep[Index(i, j, k)]+= energyDeposit;
+	return value/outputQuantities[quantity].unit;
+}
 
-				return true;
-			}
-		}
+G4bool DetectorMatrix::StoreNpyArray(const G4String& filename, size_t l, G4int quantity)
+{
+	std::ofstream out(filename, std::ios::out | std::ios::binary);
+	if (!out.is_open())
+	{
+		G4Exception("DetectorMatrix::StoreNpyArray()", "PDD1002", JustWarning,
+				("Cannot open " + filename).c_str());
+		return false;
 	}
 
-	G4int Z = particleDef-> GetAtomicNumber();
-	G4int A = particleDef-> GetAtomicMass();
-	G4String fullName = particleDef -> GetParticleName();
-	G4String name = fullName.substr (0, fullName.find("[") ); // cut excitation energy
+	// NPY format 1.0: magic, header length, header dictionary padded to a multiple of 64 bytes
+	const uint16_t one = 1;
+	G4bool littleEndian = *reinterpret_cast<const char*>(&one) == 1;
 
-	// Let's put a new particle in our store...
-	ion newIon = {
-			(trackID == 1) ? true:false,
-					PDGencoding,
-					name,
-					name.length(),
-					Z,
-					A,
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ]
-	};
+	std::ostringstream dict;
+	dict << "{'descr': '" << (littleEndian ? '<' : '>') << "f8', 'fortran_order': False, 'shape': ("
+			<< fNX << ", " << fNY << ", " << fNZ << "), }";
+	std::string header = dict.str();
+	header.append(63 - (10 + header.size()) % 64, ' ');
+	header += '\n';
 
-	// Initialize data
-	if (newIon.eDep && newIon.letN && newIon.letD && newIon.fluence)
-	{
-		for(G4int q=0; q<fNX * fNY * fNZ; q++)
+	char preamble[10] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+			char(header.size() & 0xff), char(header.size() >> 8) };
+	out.write(preamble, sizeof(preamble));
+	out.write(header.data(), header.size());
+
+	// C order: k runs fastest, as in Index(i, j, k)
+	std::vector<G4double> row(fNZ);
+	for(G4int i = 0; i < fNX; i++)
+		for(G4int j = 0; j < fNY; j++)
 		{
-			newIon.eDep[q] = 0;
-			newIon.letN[q] = 0;
-			newIon.letD[q] = 0;
-			newIon.fluence[q] = 0;
+			for(G4int k = 0; k < fNZ; k++) row[k] = Normalise(quantity, GetRawOutputValue(l, quantity, i, j, k));
+			out.write(reinterpret_cast<const char*>(row.data()), fNZ * sizeof(G4double));
 		}
 
-		newIon.eDep[Index(i, j, k)]+=energyDeposit;
+	out.close();
+	if (out.fail()) return false;
+	fStoredFiles.push_back(filename);
+	return true;
+}
 
-		ionStore.push_back(newIon);
-		return true;
+// Raw dump of the accumulated data (native byte order):
+//   char[6] "PDDRAW", uint16 version, int32 nX, nY, nZ, float64 voxel mass (0 if not uniform), volume,
+//   uint32 number of depth bin edges (0 if uniform), float64 edges,
+//   float64 radius of a cylindrical grid (0 if Cartesian), int64 events, uint32 species, then for every species
+//   uint8 primary, uint8 hasLet, int32 PDG, Z, A, uint32 name length, name,
+//   and the non-empty voxels (see VoxelAccumulator::Write)
+void DetectorMatrix::WriteRaw(std::ostream& out) const
+{
+	const uint16_t version = 3;
+	const int32_t shape[3] = { fNX, fNY, fNZ };
+	const G4double voxel[2] = { fMassOfVoxel, fVolumeOfVoxel };
+	const uint32_t nEdges = fZEdges.size();
+	const int64_t nEvents = fNumberOfEvents;
+	const uint32_t nSpecies = ionStore.size();
+
+	out.write("PDDRAW", 6);
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(shape), sizeof(shape));
+	out.write(reinterpret_cast<const char*>(voxel), sizeof(voxel));
+	out.write(reinterpret_cast<const char*>(&nEdges), sizeof(nEdges));
+	out.write(reinterpret_cast<const char*>(fZEdges.data()), nEdges * sizeof(G4double));
+	out.write(reinterpret_cast<const char*>(&fRadius), sizeof(fRadius));
+	out.write(reinterpret_cast<const char*>(&nEvents), sizeof(nEvents));
+	out.write(reinterpret_cast<const char*>(&nSpecies), sizeof(nSpecies));
+
+	for (size_t l=0; l < ionStore.size(); l++)
+	{
+		const ion& species = ionStore[l];
+		const uint8_t flags[2] = { uint8_t(species.isPrimary), uint8_t(species.hasLet) };
+		const int32_t codes[3] = { species.PDGencoding, species.Z, species.A };
+		const uint32_t nameLength = species.name.size();
+
+		out.write(reinterpret_cast<const char*>(flags), sizeof(flags));
+		out.write(reinterpret_cast<const char*>(codes), sizeof(codes));
+		out.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+		out.write(species.name.data(), nameLength);
+		species.data -> Write(out);
 	}
+}
+
+// Add a raw dump to this matrix, false if it is not a dump of the same grid
+G4bool DetectorMatrix::ReadRaw(std::istream& in)
+{
+	RawHeader header;
+	if (!ReadRawHeader(in, header)) return false;
+	if (header.nX != fNX || header.nY != fNY || header.nZ != fNZ) return false;
+	if (header.zEdges != fZEdges || header.radius != fRadius) return false;
 
-	else // XXX Out of memory! XXX
+	// Read into an empty matrix first, so a bad dump leaves this one unchanged
+	DetectorMatrix dump(fNX, fNY, fNZ, fMassOfVoxel, fVolumeOfVoxel, fZEdges, fRadius);
 
+	for (G4int s=0; s<header.nSpecies; s++)
 	{
-		return false;
+		uint8_t flags[2];
+		int32_t codes[3];
+		uint32_t nameLength;
+		if (!in.read(reinterpret_cast<char*>(flags), sizeof(flags))) return false;
+		if (!in.read(reinterpret_cast<char*>(codes), sizeof(codes))) return false;
+		if (!in.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength))) return false;
+		std::string name(nameLength, ' ');
+		if (nameLength && !in.read(&name[0], nameLength)) return false;
+
+		G4bool isPrimary = flags[0];
+		G4int l;
+		std::unordered_map<G4long, G4int>::const_iterator it = dump.fSpeciesIndex.find(SpeciesKey(codes[0], isPrimary));
+		if (it != dump.fSpeciesIndex.end()) l = it->second;
+		else l = dump.AddSpecies(dump.NewIon(isPrimary, codes[0], name, codes[1], codes[2], 0, flags[1]));
+
+		if (!dump.ionStore[l].data -> Read(in)) return false;
 	}
 
+	dump.fNumberOfEvents = header.nEvents;
+	Merge(&dump);
+	return true;
 }
 
+G4bool DetectorMatrix::ReadRawHeader(std::istream& in, RawHeader& header)
+{
+	char magic[6];
+	uint16_t version = 0;
+	int32_t shape[3];
+	G4double voxel[2];
+	uint32_t nEdges = 0;
+	int64_t nEvents;
+	uint32_t nSpecies;
+
+	// Version 1 dumps have no depth bin edges (uniform bins), versions 1 and 2
+	// no radius (Cartesian grid)
+	if (!in.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != "PDDRAW") return false;
+	if (!in.read(reinterpret_cast<char*>(&version), sizeof(version)) || version < 1 || version > 3) return false;
+	if (!in.read(reinterpret_cast<char*>(shape), sizeof(shape))) return false;
+	if (!in.read(reinterpret_cast<char*>(voxel), sizeof(voxel))) return false;
+	if (version > 1 && !in.read(reinterpret_cast<char*>(&nEdges), sizeof(nEdges))) return false;
+	if (nEdges && nEdges != uint32_t(shape[2]) + 1) return false;
+	header.zEdges.assign(nEdges, 0.);
+	if (nEdges && !in.read(reinterpret_cast<char*>(header.zEdges.data()), nEdges * sizeof(G4double))) return false;
+	header.radius = 0.;
+	if (version > 2 && !in.read(reinterpret_cast<char*>(&header.radius), sizeof(header.radius))) return false;
+	if (!in.read(reinterpret_cast<char*>(&nEvents), sizeof(nEvents))) return false;
+	if (!in.read(reinterpret_cast<char*>(&nSpecies), sizeof(nSpecies))) return false;
+
+	header.nX = shape[0];
+	header.nY = shape[1];
+	header.nZ = shape[2];
+	header.massOfVoxel = voxel[0];
+	header.volumeOfVoxel = voxel[1];
+	header.nEvents = nEvents;
+	header.nSpecies = nSpecies;
+	return true;
+}
 
-G4bool DetectorMatrix::FillLet(G4int i, G4int j, G4int k, G4double energyDeposit, G4double /*dx*/, G4double kinEMean, G4int trackID, G4ParticleDefinition* particleDef, G4Material* mat){
-
-	// Get Particle Data Group particle ID
-	G4int PDGencoding = particleDef -> GetPDGEncoding();
-	PDGencoding -= PDGencoding%10;
+// Reduced view of the data scored so far (Snapshot.out): the depth profile
+// along the central axis (mean of the central 1 or 2 voxels in x and y, or of
+// the innermost radial bins) and
+// the integral of every species. The profile only reads the axis voxels, the
+// integrals visit the allocated tiles of sparse storage and every voxel of
+// dense storage
+G4String DetectorMatrix::GetSnapshot() const
+{
+	std::ostringstream out;
 
-	// ICRU stopping power calculation
-	G4EmCalculator emCal;
-	// use the mean kinetic energy of ions in a step to calculate ICRU stopping power
-	G4double Lsn = emCal.ComputeElectronicDEDX(kinEMean, particleDef, mat);
+	// Voxels on the axis: the central 1 or 2 in x and y, or the innermost
+	// radial bin of every azimuthal bin of a cylindrical grid
+	std::vector<std::pair<G4int, G4int> > axis;
+	if (IsCylindrical())
+	{
+		for (G4int j = 0; j < fNY; j++) axis.push_back(std::make_pair(0, j));
+	}
+	else
+	{
+		const G4int iAxis[2] = { (fNX - 1) / 2, fNX / 2 };
+		const G4int jAxis[2] = { (fNY - 1) / 2, fNY / 2 };
+		for (G4int a = 0; a < 2; a++)
+			for (G4int b = 0; b < 2; b++)
+			{
+				if ((a && iAxis[1] == iAxis[0]) || (b && jAxis[1] == jAxis[0])) continue;
+				axis.push_back(std::make_pair(iAxis[a], jAxis[b]));
+			}
+	}
+	const G4double axisVoxels = axis.size();
 
-	// Search for already allocated data...
-	for (size_t l=0; l < ionStore.size(); l++)
+	out << "# events " << fNumberOfEvents << "\n";
+	if (!fZEdges.empty())
 	{
-		if (ionStore[l].PDGencoding == PDGencoding )
-		{   // Is it a primary or a secondary particle?
+		out << "# z edges [mm]";
+		for (size_t n = 0; n < fZEdges.size(); n++) out << ' ' << fZEdges[n]/mm;
+		out << "\n";
+	}
+	out << "# central axis\nk\tEdep[" << outputQuantities[kEDepOutput].unitName
+			<< "]\tLetD[" << outputQuantities[kLetOutput].unitName
+			<< "]\tFluence[" << outputQuantities[kFluenceOutput].unitName << "]\n";
 
-			if ( (trackID ==1 && ionStore[l].isPrimary) || (trackID !=1 && !ionStore[l].isPrimary))
+	for (G4int k = 0; k < fNZ; k++)
+	{
+		G4double eDep = 0., letN = 0., letD = 0., fluence = 0.;
+		for (size_t v = 0; v < axis.size(); v++)
+			for (size_t l=0; l < ionStore.size(); l++)
 			{
+				const VoxelAccumulator* data = ionStore[l].data;
+				eDep += data->Get(VoxelAccumulator::kEDep, axis[v].first, axis[v].second, k);
+				letN += data->Get(VoxelAccumulator::kLetN, axis[v].first, axis[v].second, k);
+				letD += data->Get(VoxelAccumulator::kLetD, axis[v].first, axis[v].second, k);
+				fluence += data->Get(VoxelAccumulator::kFluence, axis[v].first, axis[v].second, k);
+			}
 
-				// Fill a matrix per each ion with the fluence
+		out << k << '\t' << Normalise(kEDepOutput, eDep / axisVoxels)
+				<< '\t' << Normalise(kLetOutput, (letD > 0.) ? letN / letD : 0.)
+				<< '\t' << Normalise(kFluenceOutput, fluence / axisVoxels) << '\n';
+	}
 
-				ionStore[l].letN[Index(i, j, k)]+=energyDeposit * Lsn;
-				ionStore[l].letD[Index(i, j, k)]+=energyDeposit;
-				return true;
-			}
-		}
+	out << "# species integrals\nspecies\tEdep[" << outputQuantities[kEDepOutput].unitName
+			<< "]\tFluence[" << outputQuantities[kFluenceOutput].unitName << "]\n";
+
+	for (size_t l=0; l < ionStore.size(); l++)
+	{
+		const VoxelAccumulator* data = ionStore[l].data;
+		out << SpeciesLabel(l) << '\t' << Normalise(kEDepOutput, data->Total(VoxelAccumulator::kEDep))
+				<< '\t' << Normalise(kFluenceOutput, data->Total(VoxelAccumulator::kFluence)) << '\n';
 	}
 
-	G4int Z = particleDef-> GetAtomicNumber();
-	G4int A = particleDef-> GetAtomicMass();
-	G4String fullName = particleDef -> GetParticleName();
-	G4String name = fullName.substr (0, fullName.find("[") ); // cut excitation energy
+	return out.str();
+}
 
-	// Let's put a new particle in our store...
-	ion newIon =
+// The previous snapshot is kept as <filename>.1
+G4bool DetectorMatrix::StoreSnapshot(const G4String& filename, const G4String& snapshot)
+{
+	G4String temporary = filename + ".tmp";
+	std::ofstream out(temporary, std::ios::out);
+	if (!out)
 	{
-			(trackID == 1) ? true:false,
-					PDGencoding,
-					name,
-					name.length(),
-					Z,
-					A,
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ]
-	};
+		G4Exception("DetectorMatrix::StoreSnapshot()", "PDD1002", JustWarning,
+				("Cannot open " + temporary).c_str());
+		return false;
+	}
 
-	// Initialize data
-	if (newIon.eDep && newIon.letN && newIon.letD && newIon.fluence)
+	out << snapshot;
+	out.close();
+	if (out.fail())
 	{
-		for(G4int q=0; q<fNX * fNY * fNZ; q++)
-		{
-			newIon.eDep[q] = 0;
-			newIon.letN[q] = 0;
-			newIon.letD[q] = 0;
-			newIon.fluence[q] = 0;
-		}
+		std::remove(temporary.c_str());
+		return false;
+	}
 
-		newIon.letN[Index(i, j, k)]+=energyDeposit * Lsn;
-		newIon.letD[Index(i, j, k)]+=energyDeposit;
+	std::rename(filename.c_str(), (filename + ".1").c_str());
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
 
-		ionStore.push_back(newIon);
-		return true;
+// Raw dump of the run (Matrix.raw), the input of pddmerge
+G4bool DetectorMatrix::StoreRaw()
+{
+	G4String rawFilename = OutputFilename("Matrix", ".raw");
+	std::ofstream out(rawFilename, std::ios::out | std::ios::binary);
+	if (!out)
+	{
+		G4Exception("DetectorMatrix::StoreRaw()", "PDD1002", JustWarning,
+				("Cannot open " + rawFilename).c_str());
+		return false;
 	}
+	WriteRaw(out);
+	out.close();
+	if (out.fail()) return false;
+	fStoredFiles.push_back(rawFilename);
+	return true;
+}
+
+G4bool DetectorMatrix::StoreNpy()
+{
+	G4bool stored = true;
+	for (size_t l=0; l < ionStore.size(); l++)
+		for (G4int q=0; q<kNOutputQuantities; q++)
+			stored = StoreNpyArray(NpyFilename(l, q), l, q) && stored;
+	return stored;
+}
+
+// Sparse binary output, one file per species: the voxels where any quantity is
+// non-zero, as sorted linear indices (i * nY + j) * nZ + k, then one column of
+// values per quantity. Layout (native byte order):
+//   char[6] "PDDCOO", uint16 version, uint32 nX, nY, nZ, nQuantities, uint64 nnz,
+//   uint32 index[nnz], float64 values[nQuantities][nnz]
+G4bool DetectorMatrix::StoreCoo()
+{
+	std::vector<uint32_t> index;
+	std::vector<G4double> values[kNOutputQuantities];
 
-	else // XXX Out of memory! XXX
+	for (size_t l=0; l < ionStore.size(); l++)
+	{
+		index.clear();
+		for (G4int q=0; q<kNOutputQuantities; q++) values[q].clear();
+
+		// Only the allocated tiles of sparse storage are visited
+		ionStore[l].data -> ForEachVoxel([&](size_t v, const G4double* raw)
+		{
+			G4double value[kNOutputQuantities];
+			value[kEDepOutput] = raw[VoxelAccumulator::kEDep];
+			value[kLetOutput] = (raw[VoxelAccumulator::kLetD] > 0.)
+					? raw[VoxelAccumulator::kLetN] / raw[VoxelAccumulator::kLetD] : 0.;
+			value[kFluenceOutput] = raw[VoxelAccumulator::kFluence];
+
+			G4bool empty = true;
+			for (G4int q=0; q<kNOutputQuantities; q++)
+				if (value[q] != 0.) empty = false;
+			if (empty) return;
+
+			index.push_back(v);
+			for (G4int q=0; q<kNOutputQuantities; q++) values[q].push_back(Normalise(q, value[q]));
+		});
+
+		BinaryFile file;
+		if (!file.Open(CooFilename(l), fCompress)) return false;
+
+		const uint16_t version = 1;
+		const uint32_t shape[4] = { uint32_t(fNX), uint32_t(fNY), uint32_t(fNZ), uint32_t(kNOutputQuantities) };
+		const uint64_t nnz = index.size();
+
+		file.Write("PDDCOO", 6);
+		file.Write(&version, sizeof(version));
+		file.Write(shape, sizeof(shape));
+		file.Write(&nnz, sizeof(nnz));
+		file.Write(index.data(), nnz * sizeof(uint32_t));
+		for (G4int q=0; q<kNOutputQuantities; q++) file.Write(values[q].data(), nnz * sizeof(G4double));
+		if (!file.Close()) return false;
+		fStoredFiles.push_back(CooFilename(l));
+	}
+	return true;
+}
 
+// JSON description of the binary outputs (Matrix.json)
+G4bool DetectorMatrix::StoreDescription()
+{
+	G4String jsonFilename = OutputFilename("Matrix", ".json");
+	std::ofstream json(jsonFilename, std::ios::out);
+	if (!json.is_open())
 	{
+		G4Exception("DetectorMatrix::StoreDescription()", "PDD1002", JustWarning,
+				("Cannot open " + jsonFilename).c_str());
 		return false;
 	}
 
-}
+	json << "{\n";
+	json << "  \"shape\": [" << fNX << ", " << fNY << ", " << fNZ << "],\n";
+	if (IsCylindrical())
+	{
+		// Equal radial and azimuthal bins, the azimuth starts on the x axis
+		json << "  \"grid\": \"cylindrical\",\n";
+		json << "  \"axes\": [\"r\", \"phi\", \"z\"],\n";
+		json << "  \"radius_mm\": " << fRadius/mm << ",\n";
+	}
+	else
+	{
+		json << "  \"grid\": \"cartesian\",\n";
+		json << "  \"axes\": [\"x\", \"y\", \"z\"],\n";
+	}
+	json << "  \"run\": " << fRunID << ",\n";
+	json << "  \"events\": " << fNumberOfEvents << ",\n";
+	// No single voxel mass for a heterogeneous phantom, see its manifest
+	if (fMassOfVoxel > 0.) json << "  \"voxel_mass_kg\": " << fMassOfVoxel/kg << ",\n";
+	else json << "  \"voxel_mass_kg\": null,\n";
+	json << "  \"voxel_volume_cm3\": " << fVolumeOfVoxel/cm3 << ",\n";
+	if (!fZEdges.empty())
+	{
+		// Non-uniform depth bins: the voxel mass and volume above are the mean ones
+		// (as they are for a cylindrical grid)
+		json << "  \"z_edges_mm\": [";
+		for (size_t n = 0; n < fZEdges.size(); n++) json << (n ? ", " : "") << fZEdges[n]/mm;
+		json << "],\n";
+	}
 
-G4bool DetectorMatrix::FillFluence(G4int i, G4int j, G4int k, G4double dx, G4double vol,  G4int trackID, G4ParticleDefinition* particleDef){
+	json << "  \"quantities\": {";
+	for (G4int q=0; q<kNOutputQuantities; q++)
+	{
+		json << (q ? ",\n" : "\n") << "    " << JsonString(outputQuantities[q].name)
+				<< ": {\"unit\": " << JsonString(outputQuantities[q].unitName)
+				<< ", \"normalisation\": "
+				<< JsonString(q == kLetOutput ? "dose averaged" : "per event") << "}";
+	}
+	json << "\n  },\n";
 
-	// Get Particle Data Group particle ID
-	G4int PDGencoding = particleDef -> GetPDGEncoding();
-	PDGencoding -= PDGencoding%10;
+	// Files are listed relative to the JSON file
+	const size_t folderLength = fOutputFolder.size() + 1;
 
-	// Search for already allocated data...
+	json << "  \"species\": [";
 	for (size_t l=0; l < ionStore.size(); l++)
 	{
-		if (ionStore[l].PDGencoding == PDGencoding )
-		{   // Is it a primary or a secondary particle?
-
-			if ( (trackID ==1 && ionStore[l].isPrimary) || (trackID !=1 && !ionStore[l].isPrimary))
-			{
+		const ion& species = ionStore[l];
 
-				// Fill a matrix per each ion with the fluence
+		json << (l ? ",\n" : "\n") << "    {\"name\": " << JsonString(species.name)
+				<< ", \"primary\": " << (species.isPrimary ? "true" : "false")
+				<< ", \"pdg\": " << species.PDGencoding
+				<< ", \"Z\": " << species.Z << ", \"A\": " << species.A;
 
-				ionStore[l].fluence[Index(i, j, k)]+=dx/vol;
-				return true;
+		if (fOutputFormat & kNpy)
+		{
+			json << ", \"files\": {";
+			for (G4int q=0; q<kNOutputQuantities; q++)
+			{
+				json << (q ? ", " : "") << JsonString(outputQuantities[q].name) << ": "
+						<< JsonString(NpyFilename(l, q).substr(folderLength));
 			}
+			json << "}";
 		}
+
+		if (fOutputFormat & kCoo) json << ", \"coo\": " << JsonString(CooFilename(l).substr(folderLength));
+
+		json << "}";
+	}
+	json << "\n  ]\n}\n";
+
+	json.close();
+	if (json.fail()) return false;
+	fStoredFiles.push_back(jsonFilename);
+	return true;
+}
+
+// Species id of a particle, registering the species the first time it is seen.
+// Isomers share the species of the ground state (last PDG digit is dropped).
+G4int DetectorMatrix::GetSpeciesID(const G4ParticleDefinition* particleDef, G4bool isPrimary)
+{
+	// Get Particle Data Group particle ID
+	G4int fullPDGencoding = particleDef -> GetPDGEncoding();
+	G4int PDGencoding = fullPDGencoding - fullPDGencoding%10;
+
+	std::unordered_map<G4long, G4int>::const_iterator it = fSpeciesIndex.find(SpeciesKey(PDGencoding, isPrimary));
+	if (it != fSpeciesIndex.end())
+	{
+		// Species read from a raw dump get their definition on first use
+		if (!ionStore[it->second].particleDef) ionStore[it->second].particleDef = particleDef;
+		return it->second;
 	}
 
 	G4int Z = particleDef-> GetAtomicNumber();
@@ -499,42 +1122,58 @@ G4bool DetectorMatrix::FillFluence(G4int i, G4int j, G4int k, G4double dx, G4dou
 	G4String fullName = particleDef -> GetParticleName();
 	G4String name = fullName.substr (0, fullName.find("[") ); // cut excitation energy
 
-	// Let's put a new particle in our store...
-	ion newIon =
-	{
-			(trackID == 1) ? true:false,
-					PDGencoding,
-					name,
-					name.length(),
-					Z,
-					A,
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ],
-					new G4double[fNX * fNY * fNZ]
-	};
+	// LET is scored for all but neutrons, gammas and electrons
+	G4bool hasLet = !(Z==0 && A==1) && fullPDGencoding != 22 && fullPDGencoding != 11;
 
-	// Initialize data
-	if (newIon.eDep && newIon.letN && newIon.letD && newIon.fluence)
-	{
-		for(G4int q=0; q<fNX * fNY * fNZ; q++)
-		{
-			newIon.eDep[q] = 0;
-			newIon.letN[q] = 0;
-			newIon.letD[q] = 0;
-			newIon.fluence[q] = 0;
-		}
+	// Let's put a new particle in our store...
+	return AddSpecies(NewIon(isPrimary, PDGencoding, name, Z, A, particleDef, hasLet));
+}
 
-		newIon.fluence[Index(i, j, k)]+=dx/vol;
+G4int DetectorMatrix::AddSpecies(const ion& newIon)
+{
+	G4int id = ionStore.size();
 
-		ionStore.push_back(newIon);
-		return true;
+	// Hits store the species id in 16 bits
+	if (id > 0xFFFF)
+	{
+		G4Exception("DetectorMatrix::AddSpecies()", "PDD1001", FatalException,
+				"Too many species for the hit records (more than 65536).");
 	}
 
-	else // XXX Out of memory! XXX
+	ionStore.push_back(newIon);
+	fSpeciesIndex[SpeciesKey(newIon.PDGencoding, newIon.isPrimary)] = id;
+	return id;
+}
+
+void DetectorMatrix::Fill(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit, G4double dx, G4double kinEMean, const G4Material* mat)
+{
+	FillEdep(speciesID, i, j, k, energyDeposit);
 
+	// calculate only energy deposit
+	if( ionStore[speciesID].hasLet && energyDeposit>0. && dx >0. )
 	{
-		return false;
+		FillLet(speciesID, i, j, k, energyDeposit, dx, kinEMean, mat);
 	}
 
+	FillFluence(speciesID, i, j, k, dx);
+}
+
+void DetectorMatrix::FillEdep(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit)
+{
+	ionStore[speciesID].data->Add(VoxelAccumulator::kEDep, i, j, k, energyDeposit);
+}
+
+void DetectorMatrix::FillLet(G4int speciesID, G4int i, G4int j, G4int k, G4double energyDeposit, G4double /*dx*/, G4double kinEMean, const G4Material* mat)
+{
+	// ICRU stopping power calculation (tabulated per particle and material)
+	// use the mean kinetic energy of ions in a step to calculate ICRU stopping power
+	G4double Lsn = fStoppingPower.GetElectronicDEDX(kinEMean, ionStore[speciesID].particleDef, mat);
+
+	ionStore[speciesID].data->Add(VoxelAccumulator::kLetN, i, j, k, energyDeposit * Lsn);
+	ionStore[speciesID].data->Add(VoxelAccumulator::kLetD, i, j, k, energyDeposit);
+}
+
+void DetectorMatrix::FillFluence(G4int speciesID, G4int i, G4int j, G4int k, G4double dx)
+{
+	ionStore[speciesID].data->Add(VoxelAccumulator::kFluence, i, j, k, dx/(fVolumeOfSlice[k] * fRingScale[i]));
 }
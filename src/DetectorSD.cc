@@ -24,14 +24,24 @@
 #include "G4Step.hh"
 #include "G4ThreeVector.hh"
 #include "G4SDManager.hh"
+#include "G4EventManager.hh"
+#include "G4Event.hh"
+#include "G4RunManager.hh"
+#include "G4Run.hh"
 #include "G4ios.hh"
-#include "G4Box.hh"
+#include "G4Material.hh"
 
+// C++ Headers
+#include <algorithm>
+
+DetectorSD::ScoringMode DetectorSD::scoringMode = DetectorSD::kHits;
 
 DetectorSD::DetectorSD(const G4String& name,
 		const G4String& hitsCollectionName)
 : G4VSensitiveDetector(name),
-  fHitsCollection(NULL)
+  fHitsCollection(NULL),
+  fEvent(NULL),
+  fSplitSteps(false)
 {
 	collectionName.insert(hitsCollectionName);
 }
@@ -42,13 +52,29 @@ DetectorSD::~DetectorSD()
 void DetectorSD::Initialize(G4HCofThisEvent* HCE)
 {
 	// Create hits collection
-	fHitsCollection = new PDD1HitsCollection(SensitiveDetectorName, collectionName[0]);
+	// The hit records of the previous event are dropped, their memory is kept,
+	// unless the event is still alive and needs its own copy
+	if (fHitsCollection && PreviousEventKept()) fHitsCollection -> Keep();
+	fHits.clear();
+	fHitsCollection = new PDD1HitsCollection(SensitiveDetectorName, collectionName[0], &fHits);
+	fEvent = G4EventManager::GetEventManager() -> GetConstCurrentEvent();
 
 	// Add this collection in hce
 	G4int HCID = G4SDManager::GetSDMpointer()->GetCollectionID(collectionName[0]);
 	HCE->AddHitsCollection( HCID, fHitsCollection );
 }
 
+// Kept events are stored in the current run until it is deleted. A previous
+// event which is not among them has been deleted, and so has its collection
+G4bool DetectorSD::PreviousEventKept() const
+{
+	const G4Run* run = G4RunManager::GetRunManager() -> GetCurrentRun();
+	if (!run || !fEvent || !run->GetEventVector()) return false;
+
+	const std::vector<const G4Event*>& kept = *run->GetEventVector();
+	return std::find(kept.begin(), kept.end(), fEvent) != kept.end();
+}
+
 G4bool DetectorSD::ProcessHits(G4Step* aStep, G4TouchableHistory*)
 {  
 
@@ -67,10 +93,7 @@ G4bool DetectorSD::ProcessHits(G4Step* aStep, G4TouchableHistory*)
 	G4double eDep = aStep->GetTotalEnergyDeposit();
 
 	// Get the secondary particles in current step
-	G4Step fstep = *theTrack -> GetStep();
-
-	// Store all the secondary particles in current step
-	const std::vector<const G4Track*> * secondary = fstep.GetSecondaryInCurrentStep();
+	const std::vector<const G4Track*> * secondary = aStep -> GetSecondaryInCurrentStep();
 
 	size_t secondariesSize = (*secondary).size();
 	G4double secondariesEDep = 0.;
@@ -93,9 +116,6 @@ G4bool DetectorSD::ProcessHits(G4Step* aStep, G4TouchableHistory*)
 
 	if (eDep==0. && secondariesEDep==0.) return false;
 
-	// Particle name
-	G4String particleName =  particleDef -> GetParticleName();
-
 	// TrackID
 	G4int trackID = theTrack -> GetTrackID();
 
@@ -108,12 +128,6 @@ G4bool DetectorSD::ProcessHits(G4Step* aStep, G4TouchableHistory*)
 	// Atomic mass
 	//G4int A = particleDef-> GetAtomicMass();
 
-	// Read voxel indexes: i is the x index, k is the z index
-	const G4VTouchable* touchable = aStep->GetPreStepPoint()->GetTouchable();
-	G4int k  = touchable->GetReplicaNumber(0);
-	G4int j  = touchable->GetReplicaNumber(1);
-	G4int i  = touchable->GetReplicaNumber(2);
-
     // Pre-step kinetic energy
     G4double kinEPre = aStep -> GetPreStepPoint() -> GetKineticEnergy();
 
@@ -126,37 +140,74 @@ G4bool DetectorSD::ProcessHits(G4Step* aStep, G4TouchableHistory*)
     // Material
     G4Material * mat = aStep -> GetPreStepPoint() -> GetMaterial();
 
-    // Volume
+	G4ThreeVector prePosition = aStep->GetPreStepPoint()->GetPosition();
+	G4ThreeVector postPosition = aStep->GetPostStepPoint()->GetPosition();
+
+	// Steps not stopped at the voxel walls: the deposit and the step length
+	// are shared among the voxels crossed by the chord of the step, in
+	// proportion to the length inside each one, and the kinetic energy is
+	// interpolated linearly along the step
+	if (fSplitSteps)
+	{
+		fGrid.Traverse(prePosition, postPosition, fSegments);
 
-    G4Box* voxel_geo = (G4Box*) touchable->GetVolume(0)->GetLogicalVolume()->GetSolid();
-    G4double vol = voxel_geo->GetCubicVolume();
+		// Shares of the whole chord: the parts outside the grid are dropped
+		G4double chord = (postPosition - prePosition).mag();
 
+		// A single segment is shared out too, since the step may be only partly
+		// inside the grid. Steps with no segment are shorter than the geometry
+		// tolerance and are located by their midpoint
+		if (!fSegments.empty())
+		{
+			for (size_t s=0; s<fSegments.size(); s++)
+			{
+				const ScoringGrid::Segment& segment = fSegments[s];
+				G4double fraction = segment.length / chord;
+				G4double kinEVoxel = kinEPre + (kinEPost - kinEPre) * (segment.start + 0.5 * segment.length) / chord;
+
+				Score(particleDef, trackID, segment.i, segment.j, segment.k,
+						(eDep + secondariesEDep) * fraction, DX * fraction, kinEVoxel, mat);
+			}
+			return true;
+		}
+	}
+
+	// Voxel indexes (i is the x index, k is the z index) of the middle of the
+	// step, which is inside the voxel when the geometry stops steps at its walls
+	G4int i, j, k;
+	if (!fGrid.Locate((prePosition + postPosition) * 0.5, i, j, k)) return false;
+
+	Score(particleDef, trackID, i, j, k, eDep + secondariesEDep, DX, kinEMean, mat);
+
+	return true;
+}
+
+void DetectorSD::Score(const G4ParticleDefinition* particleDef, G4int trackID, G4int i, G4int j, G4int k,
+		G4double eDep, G4double dx, G4double kinEMean, const G4Material* mat)
+{
 	DetectorMatrix* matrix = DetectorMatrix::GetInstance();
 
-	if (matrix)
+	if (matrix && scoringMode == kStreaming)
+	{
+		matrix->Fill(matrix->GetSpeciesID(particleDef, trackID == 1), i, j, k, eDep, dx, kinEMean, mat);
+	}
+	else if (matrix)
 	{
 
-		DetectorHit* detectorHit = new DetectorHit();
+		DetectorHit detectorHit;
 
-		detectorHit->SetTrackID (trackID);
-		detectorHit->SetIx (i);
-		detectorHit->SetIy (j);
-		detectorHit->SetIz (k);
-		detectorHit->SetEdep (eDep);
-		detectorHit->SetSecondariesEdep (secondariesEDep);
-		detectorHit->SetDX (DX);
-		detectorHit->SetKinEMean (kinEMean);
-		detectorHit->SetPos (aStep->GetPreStepPoint()->GetPosition());
-		detectorHit->SetParticleDef (particleDef);
-		detectorHit->SetMat (mat);
-		detectorHit->SetVol (vol);
+		detectorHit.voxel = matrix->Index(i, j, k);
+		detectorHit.trackID = trackID;
+		detectorHit.speciesID = matrix->GetSpeciesID(particleDef, trackID == 1);
+		detectorHit.materialID = mat->GetIndex();
+		detectorHit.eDep = eDep;
+		detectorHit.dx = dx;
+		detectorHit.kinEMean = kinEMean;
 
-		fHitsCollection -> insert(detectorHit);
+		fHits.push_back(detectorHit);
 
-		//detectorHit->Print();
+		//detectorHit.Print();
 	}
-
-	return true;
 }
 
 void DetectorSD::EndOfEvent(G4HCofThisEvent* HCE)
@@ -167,7 +218,7 @@ void DetectorSD::EndOfEvent(G4HCofThisEvent* HCE)
 		<< G4endl
 		<< "-------->Hits Collection: in this event they are " << nofHits
 		<< " hits in the tracker chambers: " << G4endl;
-		for ( G4int i=0; i<nofHits; i++ ) (*fHitsCollection)[i]->Print();
+		for ( G4int i=0; i<nofHits; i++ ) (*fHitsCollection)[i].Print();
 	}
 
 	static G4int HCID = -1;
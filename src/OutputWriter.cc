@@ -0,0 +1,107 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "OutputWriter.hh"
+
+// Geant4 Headers
+#include "G4AutoLock.hh"
+
+OutputWriter* OutputWriter::instance = NULL;
+G4int OutputWriter::maxPending = 1;
+
+OutputWriter* OutputWriter::GetInstance()
+{
+	if (!instance) instance = new OutputWriter();
+	return instance;
+}
+
+void OutputWriter::DeleteInstance()
+{
+	delete instance;
+	instance = NULL;
+}
+
+OutputWriter::OutputWriter()
+: fThread(NULL),
+  fBusy(false),
+  fStop(false)
+{
+#ifdef G4MULTITHREADED
+	fThread = new G4Thread(&OutputWriter::Loop, this);
+#endif
+}
+
+OutputWriter::~OutputWriter()
+{
+	if (!fThread) return;
+
+	{
+		G4AutoLock lock(&fMutex);
+		fStop = true;
+	}
+	G4CONDITIONBROADCAST(&fChanged);
+
+	// The loop only stops once the queue is empty
+	fThread -> join();
+	delete fThread;
+}
+
+void OutputWriter::Submit(const Job& job)
+{
+	if (!fThread)
+	{
+		job();
+		return;
+	}
+
+	G4AutoLock lock(&fMutex);
+	while (G4int(fJobs.size()) >= maxPending && maxPending > 0) G4CONDITIONWAIT(&fChanged, &lock);
+	fJobs.push_back(job);
+	G4CONDITIONBROADCAST(&fChanged);
+}
+
+void OutputWriter::Flush()
+{
+	if (!fThread) return;
+
+	G4AutoLock lock(&fMutex);
+	while (!fJobs.empty() || fBusy) G4CONDITIONWAIT(&fChanged, &lock);
+}
+
+void OutputWriter::Loop()
+{
+	G4AutoLock lock(&fMutex);
+	for (;;)
+	{
+		while (fJobs.empty() && !fStop) G4CONDITIONWAIT(&fChanged, &lock);
+		if (fJobs.empty()) break;
+
+		Job job = fJobs.front();
+		fJobs.pop_front();
+		fBusy = true;
+		G4CONDITIONBROADCAST(&fChanged);
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		fBusy = false;
+		G4CONDITIONBROADCAST(&fChanged);
+	}
+}
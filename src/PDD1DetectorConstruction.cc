@@ -18,12 +18,18 @@
 // PDD headers
 #include "PDD1DetectorConstruction.hh"
 #include "PDD1NestedPhantomParameterisation.hh"
+#include "PDD1DetectorMessenger.hh"
+#include "PDD1ParallelWorld.hh"
+#include "PDD1PhantomParameterisation.hh"
+#include "VoxelPhantom.hh"
 #include "DetectorSD.hh"
 #include "DetectorMatrix.hh"
 #include "Materials.hh"
 
 // Geant4 headers
 #include "G4RunManager.hh"
+#include "G4VModularPhysicsList.hh"
+#include "G4ParallelWorldPhysics.hh"
 #include "G4PSEnergyDeposit3D.hh"
 #include "G4PSNofStep3D.hh"
 #include "G4PSCellFlux3D.hh"
@@ -41,6 +47,7 @@
 #include "G4PVPlacement.hh"
 #include "G4SDManager.hh"
 #include "G4PVParameterised.hh"
+#include "G4PVReplica.hh"
 #include "G4VisAttributes.hh"
 #include "G4Colour.hh"
 #include "G4SystemOfUnits.hh"    
@@ -48,6 +55,9 @@
 #include "G4UnitsTable.hh"
 #include "G4SystemOfUnits.hh"
 
+// C++ Headers
+#include <algorithm>
+
 PDD1DetectorConstruction::PDD1DetectorConstruction()
 : G4VUserDetectorConstruction() ,
   fPhantomLogicalVolume(0),
@@ -55,6 +65,13 @@ PDD1DetectorConstruction::PDD1DetectorConstruction()
   fDetectorSD(0),
   matrix(0)
 {
+	fVoxelisation = kNested;
+	fScoringWorld = kMass;
+	fParallelWorld = 0;
+	fVoxelPhantom = 0;
+	fScoringRadius = 0.;
+
+	fMessenger = new PDD1DetectorMessenger(this);
 
 	const G4double ug = 1.e-6*g;
 	const G4double ppm = ug/g;
@@ -83,7 +100,10 @@ PDD1DetectorConstruction::PDD1DetectorConstruction()
 }
 
 PDD1DetectorConstruction::~PDD1DetectorConstruction()
-{}
+{
+	delete fMessenger;
+	delete fVoxelPhantom;
+}
 
 G4VPhysicalVolume* PDD1DetectorConstruction::Construct()
 {
@@ -166,7 +186,7 @@ G4VPhysicalVolume* PDD1DetectorConstruction::Construct()
 	G4RotationMatrix* rot2 = new G4RotationMatrix();
 	//rot2->rotateY(30.*deg);
 	G4ThreeVector positionDetectorToPhantom = fDetectorToPhantomPosition;// G4ThreeVector(0,0,-phantom_size.z()/2.+detector_size.z()/2.);
-	//G4VPhysicalVolume * physiPhantom =
+	G4VPhysicalVolume * detector_phys =
 	new G4PVPlacement(rot2,				// no rotation
 			positionDetectorToPhantom,	// at (x,y,z)
 			detector_log,				// its logical volume
@@ -179,67 +199,63 @@ G4VPhysicalVolume* PDD1DetectorConstruction::Construct()
 	// Phantom segmentation using Parameterisation
 	//..............................................
 	//
+	// The materials of a voxel phantom are those of the voxel volumes
+	if (fVoxelPhantom && (fVoxelisation == kNone || fScoringWorld == kParallel))
+	{
+		G4Exception("PDD1DetectorConstruction::Construct()", "PDD1003", JustWarning,
+				"The voxel phantom needs voxel volumes in the mass world, using the regular voxelisation");
+		fVoxelisation = kRegular;
+		fScoringWorld = kMass;
+	}
+
+	// Cylindrical bins are not built as volumes, the scorer splits the steps
+	if (fScoringRadius > 0. && fVoxelisation != kNone)
+	{
+		G4Exception("PDD1DetectorConstruction::Construct()", "PDD1004", JustWarning,
+				"The cylindrical scoring grid is not built as volumes, using the voxelisation none");
+		fVoxelisation = kNone;
+	}
+	if (fScoringRadius > 0. && 2. * fScoringRadius > std::min(fDetectorSize.x(), fDetectorSize.y()))
+	{
+		G4Exception("PDD1DetectorConstruction::Construct()", "PDD1004", JustWarning,
+				"The scoring cylinder is wider than the detector, its outer bins are only partly scored");
+	}
+
+	// The regular structure needs equal voxels
+	if (!fZEdges.empty() && fVoxelisation == kRegular)
+	{
+		G4Exception("PDD1DetectorConstruction::Construct()", "PDD1004", JustWarning,
+				"The regular voxelisation needs uniform depth bins, using the nested voxelisation");
+		fVoxelisation = kNested;
+	}
+
 	G4cout << "<-- PDD1DetectorConstruction::Construct-------" <<G4endl;
 	G4cout << "  Phantom Material " << fPhantomMaterial->GetName() << G4endl;
 	G4cout << "  Phantom Size " << fPhantomSize/mm << G4endl;
 	G4cout << "  Detector Material " << fDetectorMaterial->GetName() << G4endl;
 	G4cout << "  Detector Size " << fDetectorSize/mm << G4endl;
-	G4cout << "  Segmentation  ("<< fNX<<","<<fNY<<","<<fNZ<<")"<< G4endl;
+	G4cout << "  Segmentation  ("<< fNX<<","<<fNY<<","<<fNZ<<")"
+			<< ((fScoringRadius > 0.) ? " (r,phi,z)" : "") << G4endl;
+	G4cout << "  Voxelisation " << GetVoxelisationName()
+			<< ((fScoringWorld == kParallel) ? " (parallel world)" : "") << G4endl;
 	G4cout << "<---------------------------------------------"<< G4endl;
-	// Number of segmentation.
-	// - Default number of segmentation is defined at constructor.
-	G4ThreeVector sensSize;
-	sensSize.setX(fDetectorSize.x()/(G4double)fNX);
-	sensSize.setY(fDetectorSize.y()/(G4double)fNY);
-	sensSize.setZ(fDetectorSize.z()/(G4double)fNZ);
-
-	// Replication of Water Phantom Volume.
-	// Y Slice
-	G4String yRepName("RepY");
-	G4VSolid* solYRep =
-			new G4Box(yRepName,fDetectorSize.x()/2.,sensSize.y()/2.,fDetectorSize.z()/2.);
-	G4LogicalVolume* logYRep =
-			new G4LogicalVolume(solYRep,fDetectorMaterial,yRepName);
-	//G4PVReplica* yReplica =
-	new G4PVReplica(yRepName,logYRep,detector_log,kYAxis,fNY,sensSize.y());
-	// X Slice
-	G4String xRepName("RepX");
-	G4VSolid* solXRep =
-			new G4Box(xRepName,sensSize.x()/2.,sensSize.y()/2.,fDetectorSize.z()/2.);
-	G4LogicalVolume* logXRep =
-			new G4LogicalVolume(solXRep,fDetectorMaterial,xRepName);
-	//G4PVReplica* xReplica =
-	new G4PVReplica(xRepName,logXRep,logYRep,kXAxis,fNX,sensSize.x());
-
-	//
-	//..................................
-	// Voxel solid and logical volumes
-	//..................................
-	// Z Slice
-	G4String zVoxName("phantomSens");
-	G4VSolid* solVoxel =
-			new G4Box(zVoxName,sensSize.x()/2.,sensSize.y()/2.,sensSize.z()/2.);
-	fVoxelLogicalVolume = new G4LogicalVolume(solVoxel,fDetectorMaterial,zVoxName);
-	//
-	//
-	std::vector<G4Material*> detectorMat(2,fDetectorMaterial);
+	// Without voxel volumes in the mass world the transport sees a
+	// homogeneous detector
+	if (fScoringWorld == kParallel || fVoxelisation == kNone)
+	{
+		detector_log->SetMaterial(fDetectorMaterial);
+	}
 
-	//
-	// Parameterisation for transformation of voxels.
-	//  (voxel size is fixed in this example.
-	//  e.g. nested parameterisation handles material and transfomation of voxels.)
-	PDD1NestedPhantomParameterisation* paramPhantom
-	= new PDD1NestedPhantomParameterisation(sensSize/2.,fNZ,detectorMat);
-	//G4VPhysicalVolume * physiPhantomSens =
-	new G4PVParameterised("PhantomSens",    // their name
-			fVoxelLogicalVolume,    		// their logical volume
-			logXRep,           				// Mother logical volume
-			kUndefined,        				// Are placed along this axis
-			fNZ,           					// Number of cells
-			paramPhantom);     				// Parameterisation.
-	//   Optimization flag is avaiable for,
-	//    kUndefined, kXAxis, kYAxis, kZAxis.
-	//
+	if (fScoringWorld == kMass)
+	{
+		ConstructVoxels(detector_phys);
+		fScoringVolumeVector.push_back(fVoxelLogicalVolume);
+	}
+	else
+	{
+		// The voxels are built in the parallel world
+		fScoringVolumeVector.push_back(detector_log);
+	}
 
 	//===============================
 	//   Visualization attributes
@@ -249,33 +265,138 @@ G4VPhysicalVolume* PDD1DetectorConstruction::Construct()
 	G4VisAttributes* phantomVisAtt = new G4VisAttributes(G4Colour(1.0,1.0,0.0));
 	detector_log->SetVisAttributes(phantomVisAtt);
 
-	// Replica
-	G4VisAttributes* yRepVisAtt = new G4VisAttributes(G4Colour(0.0,1.0,0.0));
-	logYRep->SetVisAttributes(yRepVisAtt);
-	G4VisAttributes* xRepVisAtt = new G4VisAttributes(G4Colour(0.0,1.0,0.0));
-	logXRep->SetVisAttributes(xRepVisAtt);
-
-	// Skip the visualization for those voxels.
-	fVoxelLogicalVolume->SetVisAttributes(G4VisAttributes::GetInvisible());
-
-	fScoringVolumeVector.push_back(fVoxelLogicalVolume);
-
 	if (!fpRegion)
 	{
 		fpRegion = new G4Region("Target");
-		fVoxelLogicalVolume -> SetRegion(fpRegion);
-		fpRegion->AddRootLogicalVolume( fVoxelLogicalVolume );
+		fScoringVolumeVector[0] -> SetRegion(fpRegion);
+		fpRegion->AddRootLogicalVolume( fScoringVolumeVector[0] );
 	}
 
-	fVolumeOfVoxel = fNX * fNY * fNZ;
-	fMassOfVoxel = fDetectorMaterial -> GetDensity() * fVolumeOfVoxel;
+	// The voxels of a heterogeneous phantom have different masses (0: not
+	// uniform, the manifest lists the mass of a voxel of every phantom material)
+	fVolumeOfVoxel = GetScoringGrid().GetVoxelVolume();
+	fMassOfVoxel = fVoxelPhantom ? 0. : fDetectorMaterial -> GetDensity() * fVolumeOfVoxel;
 
 	//  This will clear the existing matrix (together with all data inside it)!
-	matrix = DetectorMatrix::GetInstance(fNX, fNY, fNZ, fMassOfVoxel);
+	matrix = DetectorMatrix::GetInstance(fNX, fNY, fNZ, fMassOfVoxel, fVolumeOfVoxel, fZEdges, fScoringRadius);
 
 	return world_phys;
 }
 
+void PDD1DetectorConstruction::ConstructVoxels(G4VPhysicalVolume* detector_phys)
+{
+	G4LogicalVolume* detector_log = detector_phys->GetLogicalVolume();
+	G4Box* detector_geo = static_cast<G4Box*>(detector_log->GetSolid());
+
+	if (fVoxelisation == kNone)
+	{
+		// The detector box itself is sensitive, the scoring grid locates the steps
+		fVoxelLogicalVolume = detector_log;
+		return;
+	}
+
+	// Voxel size
+	G4ThreeVector sensSize = GetScoringGrid().GetPitch();
+
+	if (fVoxelisation == kRegular)
+	{
+		// Regular structure: the voxels are copies of a single parameterised
+		// volume filling the detector, copy number ix + nX*(iy + nY*iz).
+		G4String voxName("phantomSens");
+		G4VSolid* solVoxel =
+				new G4Box(voxName,sensSize.x()/2.,sensSize.y()/2.,sensSize.z()/2.);
+		fVoxelLogicalVolume = new G4LogicalVolume(solVoxel,fDetectorMaterial,voxName);
+
+		// Materials of the phantom voxels, or a homogeneous detector
+		std::vector<G4Material*> detectorMat(1,fDetectorMaterial);
+		if (fVoxelPhantom) detectorMat = fVoxelPhantom->GetMaterials();
+		size_t nVoxels = size_t(fNX) * fNY * fNZ;
+
+		PDD1PhantomParameterisation* paramPhantom = new PDD1PhantomParameterisation(fVoxelPhantom, fDetectorMaterial);
+		paramPhantom->SetVoxelDimensions(sensSize.x()/2.,sensSize.y()/2.,sensSize.z()/2.);
+		paramPhantom->SetNoVoxel(fNX,fNY,fNZ);
+		paramPhantom->SetMaterials(detectorMat);
+		paramPhantom->BuildContainerSolid(detector_phys);
+		paramPhantom->CheckVoxelsFillContainer(detector_geo->GetXHalfLength(),
+				detector_geo->GetYHalfLength(), detector_geo->GetZHalfLength());
+
+		// Steps are not limited at the boundaries between voxels of the same
+		// material, DetectorSD splits them over the voxels they cross
+		paramPhantom->SetSkipEqualMaterials(true);
+
+		G4PVParameterised* phantomSens
+		= new G4PVParameterised("PhantomSens",	// their name
+				fVoxelLogicalVolume,			// their logical volume
+				detector_log,					// Mother logical volume
+				kUndefined,						// Are placed along this axis
+				G4int(nVoxels),					// Number of cells
+				paramPhantom);					// Parameterisation.
+		// Navigated by G4RegularNavigation
+		phantomSens->SetRegularStructureId(1);
+	}
+	else
+	{
+		// Replication of Water Phantom Volume.
+		// Y Slice
+		G4String yRepName("RepY");
+		G4VSolid* solYRep =
+				new G4Box(yRepName,fDetectorSize.x()/2.,sensSize.y()/2.,fDetectorSize.z()/2.);
+		G4LogicalVolume* logYRep =
+				new G4LogicalVolume(solYRep,fDetectorMaterial,yRepName);
+		//G4PVReplica* yReplica =
+		new G4PVReplica(yRepName,logYRep,detector_log,kYAxis,fNY,sensSize.y());
+		// X Slice
+		G4String xRepName("RepX");
+		G4VSolid* solXRep =
+				new G4Box(xRepName,sensSize.x()/2.,sensSize.y()/2.,fDetectorSize.z()/2.);
+		G4LogicalVolume* logXRep =
+				new G4LogicalVolume(solXRep,fDetectorMaterial,xRepName);
+		//G4PVReplica* xReplica =
+		new G4PVReplica(xRepName,logXRep,logYRep,kXAxis,fNX,sensSize.x());
+
+		//
+		//..................................
+		// Voxel solid and logical volumes
+		//..................................
+		// Z Slice
+		G4String zVoxName("phantomSens");
+		G4VSolid* solVoxel =
+				new G4Box(zVoxName,sensSize.x()/2.,sensSize.y()/2.,sensSize.z()/2.);
+		fVoxelLogicalVolume = new G4LogicalVolume(solVoxel,fDetectorMaterial,zVoxName);
+		//
+		//
+		std::vector<G4Material*> detectorMat(1,fDetectorMaterial);
+		if (fVoxelPhantom) detectorMat = fVoxelPhantom->GetMaterials();
+
+		//
+		// Parameterisation for transformation of voxels.
+		//  (voxel size is fixed in X and Y, and along Z unless depth bin edges are given.
+		//  e.g. nested parameterisation handles material and transfomation of voxels.)
+		PDD1NestedPhantomParameterisation* paramPhantom
+		= new PDD1NestedPhantomParameterisation(sensSize/2.,fNZ,detectorMat,fVoxelPhantom);
+		if (!fZEdges.empty()) paramPhantom->SetZEdges(fZEdges);
+		//G4VPhysicalVolume * physiPhantomSens =
+		new G4PVParameterised("PhantomSens",    // their name
+				fVoxelLogicalVolume,    		// their logical volume
+				logXRep,           				// Mother logical volume
+				kUndefined,        				// Are placed along this axis
+				fNZ,           					// Number of cells
+				paramPhantom);     				// Parameterisation.
+		//   Optimization flag is avaiable for,
+		//    kUndefined, kXAxis, kYAxis, kZAxis.
+		//
+
+		// Replica
+		G4VisAttributes* yRepVisAtt = new G4VisAttributes(G4Colour(0.0,1.0,0.0));
+		logYRep->SetVisAttributes(yRepVisAtt);
+		G4VisAttributes* xRepVisAtt = new G4VisAttributes(G4Colour(0.0,1.0,0.0));
+		logXRep->SetVisAttributes(xRepVisAtt);
+	}
+
+	// Skip the visualization for those voxels.
+	fVoxelLogicalVolume->SetVisAttributes(G4VisAttributes::GetInvisible());
+}
+
 void PDD1DetectorConstruction::ConstructSDandField() {
 
 	//  Sensitive Detector Manager.
@@ -311,11 +432,127 @@ void PDD1DetectorConstruction::ConstructSDandField() {
 
 	// Sensitive detectors
 	DetectorSD* phantomSD = new DetectorSD(phantomSDname2,"PhantomHitsCollection");
+	phantomSD->SetGrid(GetScoringGrid());
+	phantomSD->SetSplitSteps(fVoxelisation != kNested);
 	pSDman->AddNewDetector(phantomSD);                			// Register SD to SDManager.
 	SetSensitiveDetector( fVoxelLogicalVolume, phantomSD );    	// Assign SD to the logical volume.
 
 }
 
+G4String PDD1DetectorConstruction::GetVoxelisationName() const
+{
+	switch (fVoxelisation)
+	{
+	case kRegular: return "regular";
+	case kNone: return "none";
+	default: return "nested";
+	}
+}
+
+void PDD1DetectorConstruction::SetVoxelPhantom(const G4String& mapFilename, const G4String& tableFilename)
+{
+	VoxelPhantom* phantom = new VoxelPhantom();
+	if (!phantom->Load(mapFilename, tableFilename))
+	{
+		delete phantom;
+		G4Exception("PDD1DetectorConstruction::SetVoxelPhantom()", "PDD1003", FatalException,
+				("Cannot load the voxel phantom " + mapFilename).c_str());
+		return;
+	}
+
+	delete fVoxelPhantom;
+	fVoxelPhantom = phantom;
+	fVoxelPhantomFile = mapFilename;
+
+	// The voxels of the map are the scoring voxels
+	fDetectorSize = fVoxelPhantom->GetSize();
+	SetDetectorSegmentation(fVoxelPhantom->GetNX(), fVoxelPhantom->GetNY(), fVoxelPhantom->GetNZ());
+}
+
+void PDD1DetectorConstruction::SetDetectorZEdges(const std::vector<G4double>& edges)
+{
+	G4bool increasing = edges.size() > 1;
+	for (size_t n=1; n<edges.size(); n++) increasing = increasing && edges[n] > edges[n-1];
+	if (!increasing)
+	{
+		G4Exception("PDD1DetectorConstruction::SetDetectorZEdges()", "PDD1004", JustWarning,
+				"The depth bin edges must be at least two increasing values, ignored");
+		return;
+	}
+	if (fVoxelPhantom)
+	{
+		G4Exception("PDD1DetectorConstruction::SetDetectorZEdges()", "PDD1004", JustWarning,
+				"The depth bins of a voxel phantom are those of its map, ignored");
+		return;
+	}
+
+	// Edges are kept from the front face of the detector
+	fZEdges.resize(edges.size());
+	for (size_t n=0; n<edges.size(); n++) fZEdges[n] = edges[n] - edges.front();
+	fDetectorSize.setZ(fZEdges.back());
+	fNZ = fZEdges.size() - 1;
+}
+
+void PDD1DetectorConstruction::SetDetectorZBinning(const std::vector<G4double>& lengths, const std::vector<G4double>& pitches)
+{
+	// Every section gets a whole number of bins, as close as possible to the
+	// requested pitch, so the section lengths are kept
+	std::vector<G4double> edges(1, 0.);
+	for (size_t s=0; s<lengths.size() && s<pitches.size(); s++)
+	{
+		if (lengths[s] <= 0. || pitches[s] <= 0.) continue;
+		G4int nBins = std::max(1, G4int(lengths[s]/pitches[s] + 0.5));
+		G4double start = edges.back();
+		for (G4int n=1; n<=nBins; n++) edges.push_back(start + lengths[s]*n/nBins);
+	}
+	SetDetectorZEdges(edges);
+}
+
+void PDD1DetectorConstruction::SetCylindricalSegmentation(G4double radius, G4int nR, G4int nPhi)
+{
+	if (radius <= 0. || nR < 1 || nPhi < 1)
+	{
+		G4Exception("PDD1DetectorConstruction::SetCylindricalSegmentation()", "PDD1004", JustWarning,
+				"The cylindrical grid needs a positive radius and at least one radial and azimuthal bin, ignored");
+		return;
+	}
+	if (fVoxelPhantom)
+	{
+		G4Exception("PDD1DetectorConstruction::SetCylindricalSegmentation()", "PDD1004", JustWarning,
+				"The bins of a voxel phantom are those of its map, ignored");
+		return;
+	}
+
+	fScoringRadius = radius;
+	fNX = nR;
+	fNY = nPhi;
+}
+
+ScoringGrid PDD1DetectorConstruction::GetScoringGrid() const
+{
+	// The phantom and the detector are placed without rotation
+	G4ThreeVector center = fPhantomPosition + fDetectorToPhantomPosition;
+	if (fScoringRadius > 0.) return ScoringGrid::Cylinder(center, fScoringRadius, fNX, fNY, fDetectorSize.z(), fNZ, fZEdges);
+	if (!fZEdges.empty()) return ScoringGrid(center, fDetectorSize, fNX, fNY, fZEdges);
+	return ScoringGrid(center, fDetectorSize, fNX, fNY, fNZ);
+}
+
+void PDD1DetectorConstruction::SetScoringWorld(ScoringWorld scoringWorld)
+{
+	fScoringWorld = scoringWorld;
+
+	if (fScoringWorld != kParallel || fParallelWorld) return;
+
+	// The parallel world needs its own navigation process, the physics list
+	// is still open in PreInit
+	fParallelWorld = new PDD1ParallelWorld("ScoringWorld", this);
+	RegisterParallelWorld(fParallelWorld);
+
+	G4VModularPhysicsList* physicsList = const_cast<G4VModularPhysicsList*>(
+			dynamic_cast<const G4VModularPhysicsList*>(G4RunManager::GetRunManager()->GetUserPhysicsList()));
+	if (physicsList) physicsList->RegisterPhysics(new G4ParallelWorldPhysics("ScoringWorld"));
+}
+
 G4bool PDD1DetectorConstruction::SetPhantomMaterial(G4String material)
 {
 
@@ -431,5 +668,5 @@ void PDD1DetectorConstruction::SetDetectorSize(G4double sizeX, G4double sizeY, G
 {
 	if (sizeX > 0.) {fDetectorSize.setX(sizeX);}
 	if (sizeY > 0.) {fDetectorSize.setY(sizeY);}
-	if (sizeZ > 0.) {fDetectorSize.setZ(sizeZ);}
+	if (sizeZ > 0.) {fDetectorSize.setZ(sizeZ); fZEdges.clear();}
 }
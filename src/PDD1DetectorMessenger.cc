@@ -0,0 +1,372 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "PDD1DetectorMessenger.hh"
+#include "PDD1DetectorConstruction.hh"
+#include "DetectorMatrix.hh"
+#include "DetectorSD.hh"
+#include "VoxelPhantom.hh"
+
+// Geant4 Headers
+#include "G4UIdirectory.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIcmdWithABool.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
+#include "G4UnitsTable.hh"
+#include "G4SystemOfUnits.hh"
+
+// C++ Headers
+#include <sstream>
+#include <vector>
+
+namespace
+{
+// List of lengths with an optional unit at the end (mm by default),
+// false if a value is not a number or the unit is unknown
+G4bool ParseLengths(const G4String& text, std::vector<G4double>& values)
+{
+	std::istringstream tokens(text);
+	G4String token;
+	G4double unit = mm;
+	values.clear();
+	while (tokens >> token)
+	{
+		std::istringstream number(token);
+		G4double value;
+		if (number >> value && number.eof())
+		{
+			values.push_back(value);
+			continue;
+		}
+		// Only the last token may be a unit
+		if (tokens >> token) return false;
+		unit = G4UnitDefinition::GetValueOf(token);
+		if (unit <= 0.) return false;
+	}
+	for (size_t n=0; n<values.size(); n++) values[n] *= unit;
+	return true;
+}
+}
+
+PDD1DetectorMessenger::PDD1DetectorMessenger(PDD1DetectorConstruction* detector)
+: G4UImessenger(),
+  fDetector(detector)
+{
+	fPDD1Directory = new G4UIdirectory("/PDD1/");
+	fPDD1Directory->SetGuidance("PDD1 application commands.");
+
+	fGeometryDirectory = new G4UIdirectory("/PDD1/geometry/");
+	fGeometryDirectory->SetGuidance("Phantom geometry control.");
+
+	fVoxelisationCmd = new G4UIcmdWithAString("/PDD1/geometry/voxelisation",this);
+	fVoxelisationCmd->SetGuidance("Voxelisation of the detector.");
+	fVoxelisationCmd->SetGuidance("  nested  : Y and X replicas with a nested parameterisation along Z.");
+	fVoxelisationCmd->SetGuidance("  regular : G4PhantomParameterisation with G4RegularNavigation,");
+	fVoxelisationCmd->SetGuidance("            skipping the boundaries between voxels of equal material.");
+	fVoxelisationCmd->SetGuidance("  none    : homogeneous detector, steps are split over the voxels they");
+	fVoxelisationCmd->SetGuidance("            cross by the scorer (3D DDA).");
+	fVoxelisationCmd->SetParameterName("voxelisation",false);
+	fVoxelisationCmd->SetCandidates("nested regular none");
+	fVoxelisationCmd->AvailableForStates(G4State_PreInit);
+	fVoxelisationCmd->SetToBeBroadcasted(false);
+
+	fScoringWorldCmd = new G4UIcmdWithAString("/PDD1/geometry/scoringWorld",this);
+	fScoringWorldCmd->SetGuidance("World of the scoring voxels.");
+	fScoringWorldCmd->SetGuidance("  mass     : the voxels are part of the transport geometry.");
+	fScoringWorldCmd->SetGuidance("  parallel : the detector is a homogeneous box, the voxels live in a");
+	fScoringWorldCmd->SetGuidance("             parallel world seen only by the scoring.");
+	fScoringWorldCmd->SetGuidance("Set it before /run/initialize, it registers the parallel world physics.");
+	fScoringWorldCmd->SetParameterName("world",false);
+	fScoringWorldCmd->SetCandidates("mass parallel");
+	fScoringWorldCmd->AvailableForStates(G4State_PreInit);
+	fScoringWorldCmd->SetToBeBroadcasted(false);
+
+	fPhantomCmd = new G4UIcmdWithAString("/PDD1/geometry/phantom",this);
+	fPhantomCmd->SetGuidance("Heterogeneous detector read from a voxel map and a material table.");
+	fPhantomCmd->SetGuidance("Usage: /PDD1/geometry/phantom <map.pddvox> <table.txt>");
+	fPhantomCmd->SetGuidance("The map holds HU or material indices (uint16, x fastest), the table");
+	fPhantomCmd->SetGuidance("rows 'lower upper material densityLower densityUpper' (g/cm3).");
+	fPhantomCmd->SetGuidance("The detector size and segmentation become those of the map.");
+	fPhantomCmd->SetParameterName("files",false);
+	fPhantomCmd->AvailableForStates(G4State_PreInit);
+	fPhantomCmd->SetToBeBroadcasted(false);
+
+	fDensityStepCmd = new G4UIcmdWithADoubleAndUnit("/PDD1/geometry/phantomDensityStep",this);
+	fDensityStepCmd->SetGuidance("Density step of the phantom materials, densities are rounded to it.");
+	fDensityStepCmd->SetGuidance("Set it before /PDD1/geometry/phantom.");
+	fDensityStepCmd->SetParameterName("step",false);
+	fDensityStepCmd->SetUnitCategory("Volumic Mass");
+	fDensityStepCmd->SetRange("step>0.");
+	fDensityStepCmd->AvailableForStates(G4State_PreInit);
+	fDensityStepCmd->SetToBeBroadcasted(false);
+
+	fZEdgesCmd = new G4UIcmdWithAString("/PDD1/geometry/zBinEdges",this);
+	fZEdgesCmd->SetGuidance("Non-uniform depth bins given by their edges along the detector.");
+	fZEdgesCmd->SetGuidance("Usage: /PDD1/geometry/zBinEdges <z0> <z1> ... <zN> [unit]");
+	fZEdgesCmd->SetGuidance("The edges are measured from the front face of the detector (the first");
+	fZEdgesCmd->SetGuidance("one is shifted to it) and set its depth size and Z segmentation.");
+	fZEdgesCmd->SetParameterName("edges",false);
+	fZEdgesCmd->AvailableForStates(G4State_PreInit);
+	fZEdgesCmd->SetToBeBroadcasted(false);
+
+	fZBinningCmd = new G4UIcmdWithAString("/PDD1/geometry/zBinning",this);
+	fZBinningCmd->SetGuidance("Piecewise uniform depth bins: sections of a given length and pitch,");
+	fZBinningCmd->SetGuidance("from the front face of the detector.");
+	fZBinningCmd->SetGuidance("Usage: /PDD1/geometry/zBinning <length> <pitch> [<length> <pitch> ...] [unit]");
+	fZBinningCmd->SetGuidance("e.g. /PDD1/geometry/zBinning 250 2 40 0.1 10 2 mm");
+	fZBinningCmd->SetGuidance("The pitch is rounded so every section holds a whole number of bins.");
+	fZBinningCmd->SetParameterName("sections",false);
+	fZBinningCmd->AvailableForStates(G4State_PreInit);
+	fZBinningCmd->SetToBeBroadcasted(false);
+
+	fCylindricalCmd = new G4UIcmdWithAString("/PDD1/geometry/cylindricalGrid",this);
+	fCylindricalCmd->SetGuidance("Cylindrical scoring grid around the detector axis, for axially");
+	fCylindricalCmd->SetGuidance("symmetric beams: equal radial bins up to a radius and equal azimuthal");
+	fCylindricalCmd->SetGuidance("bins (1 for an (r,z) grid), with the depth bins of the detector.");
+	fCylindricalCmd->SetGuidance("Usage: /PDD1/geometry/cylindricalGrid <nR> <nPhi> <radius> [unit]");
+	fCylindricalCmd->SetGuidance("The outputs are indexed (r,phi,z); the voxelisation becomes none.");
+	fCylindricalCmd->SetParameterName("grid",false);
+	fCylindricalCmd->AvailableForStates(G4State_PreInit);
+	fCylindricalCmd->SetToBeBroadcasted(false);
+
+	fScoringDirectory = new G4UIdirectory("/PDD1/scoring/");
+	fScoringDirectory->SetGuidance("Scoring matrix control.");
+
+	fStorageCmd = new G4UIcmdWithAString("/PDD1/scoring/storage",this);
+	fStorageCmd->SetGuidance("Storage of the per-species voxel data.");
+	fStorageCmd->SetGuidance("  dense  : one full array per quantity and species.");
+	fStorageCmd->SetGuidance("  sparse : 8x8x8 voxel tiles allocated on first fill.");
+	fStorageCmd->SetParameterName("storage",false);
+	fStorageCmd->SetCandidates("dense sparse");
+	fStorageCmd->AvailableForStates(G4State_PreInit);
+	fStorageCmd->SetToBeBroadcasted(false);
+
+	fLayoutCmd = new G4UIcmdWithAString("/PDD1/scoring/layout",this);
+	fLayoutCmd->SetGuidance("Layout of the per-species voxel data.");
+	fLayoutCmd->SetGuidance("  planar      : one array per quantity.");
+	fLayoutCmd->SetGuidance("  interleaved : the quantities of a voxel are contiguous.");
+	fLayoutCmd->SetParameterName("layout",false);
+	fLayoutCmd->SetCandidates("planar interleaved");
+	fLayoutCmd->AvailableForStates(G4State_PreInit);
+	fLayoutCmd->SetToBeBroadcasted(false);
+
+	fModeCmd = new G4UIcmdWithAString("/PDD1/scoring/mode",this);
+	fModeCmd->SetGuidance("Scoring mode of the phantom sensitive detector.");
+	fModeCmd->SetGuidance("  hits      : store a hit per step, scored at the end of the event.");
+	fModeCmd->SetGuidance("  streaming : score every step directly, no hits collection.");
+	fModeCmd->SetParameterName("mode",false);
+	fModeCmd->SetCandidates("hits streaming");
+	fModeCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fModeCmd->SetToBeBroadcasted(false);
+
+	fVerifyStoppingPowerCmd = new G4UIcmdWithAnInteger("/PDD1/scoring/verifyStoppingPower",this);
+	fVerifyStoppingPowerCmd->SetGuidance("Check one in every N tabulated stopping powers against G4EmCalculator");
+	fVerifyStoppingPowerCmd->SetGuidance("and print the maximum relative error at the end of the run (0 disables it).");
+	fVerifyStoppingPowerCmd->SetParameterName("N",false);
+	fVerifyStoppingPowerCmd->SetRange("N>=0");
+	fVerifyStoppingPowerCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fVerifyStoppingPowerCmd->SetToBeBroadcasted(false);
+
+	fOutputDirectory = new G4UIdirectory("/PDD1/output/");
+	fOutputDirectory->SetGuidance("Scoring matrix output control.");
+
+	fFormatCmd = new G4UIcmdWithAString("/PDD1/output/format",this);
+	fFormatCmd->SetGuidance("Space separated list of the output formats of every run. They are written in the");
+	fFormatCmd->SetGuidance("background while the next run starts, and all of them before the job ends.");
+	fFormatCmd->SetGuidance("  ascii : Edep.out, Let.out and Fluence.out text tables.");
+	fFormatCmd->SetGuidance("  npy   : one NumPy array per quantity and species, described by Matrix.json.");
+	fFormatCmd->SetGuidance("  coo   : one sparse binary file per species (non-empty voxels only).");
+	fFormatCmd->SetGuidance("  raw   : Matrix.raw, the accumulated sums that pddmerge adds up.");
+	fFormatCmd->SetParameterName("formats",false);
+	fFormatCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fFormatCmd->SetToBeBroadcasted(false);
+
+	fCompressCmd = new G4UIcmdWithABool("/PDD1/output/compress",this);
+	fCompressCmd->SetGuidance("gzip the sparse binary (coo) files, if PDD1 was built with zlib.");
+	fCompressCmd->SetParameterName("compress",true);
+	fCompressCmd->SetDefaultValue(true);
+	fCompressCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fCompressCmd->SetToBeBroadcasted(false);
+
+	fSnapshotEveryCmd = new G4UIcmdWithAnInteger("/PDD1/output/snapshotEvery",this);
+	fSnapshotEveryCmd->SetGuidance("Write a reduced snapshot every N events during the run (0 disables it):");
+	fSnapshotEveryCmd->SetGuidance("central axis depth profile and species integrals, per event, in the Snapshot.out of the run.");
+	fSnapshotEveryCmd->SetParameterName("N",false);
+	fSnapshotEveryCmd->SetRange("N>=0");
+	fSnapshotEveryCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fSnapshotEveryCmd->SetToBeBroadcasted(false);
+
+	fRunDirectoriesCmd = new G4UIcmdWithABool("/PDD1/output/runDirectories",this);
+	fRunDirectoriesCmd->SetGuidance("Write the outputs and the manifest of every run to its own folder, job<N>/run<ID>,");
+	fRunDirectoriesCmd->SetGuidance("where job<N> is the first job folder free when the job starts its first run.");
+	fRunDirectoriesCmd->SetGuidance("Otherwise runs after the first one get a _run<ID> suffix, and a job does not");
+	fRunDirectoriesCmd->SetGuidance("overwrite the manifest of another one.");
+	fRunDirectoriesCmd->SetParameterName("runDirectories",true);
+	fRunDirectoriesCmd->SetDefaultValue(true);
+	fRunDirectoriesCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fRunDirectoriesCmd->SetToBeBroadcasted(false);
+}
+
+PDD1DetectorMessenger::~PDD1DetectorMessenger()
+{
+	delete fRunDirectoriesCmd;
+	delete fSnapshotEveryCmd;
+	delete fCompressCmd;
+	delete fFormatCmd;
+	delete fOutputDirectory;
+	delete fVerifyStoppingPowerCmd;
+	delete fModeCmd;
+	delete fLayoutCmd;
+	delete fStorageCmd;
+	delete fScoringDirectory;
+	delete fCylindricalCmd;
+	delete fZBinningCmd;
+	delete fZEdgesCmd;
+	delete fDensityStepCmd;
+	delete fPhantomCmd;
+	delete fScoringWorldCmd;
+	delete fVoxelisationCmd;
+	delete fGeometryDirectory;
+	delete fPDD1Directory;
+}
+
+void PDD1DetectorMessenger::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+	if( command == fVoxelisationCmd )
+	{
+		if (newValue == "regular") fDetector->SetVoxelisation(PDD1DetectorConstruction::kRegular);
+		else if (newValue == "none") fDetector->SetVoxelisation(PDD1DetectorConstruction::kNone);
+		else fDetector->SetVoxelisation(PDD1DetectorConstruction::kNested);
+	}
+	else if( command == fScoringWorldCmd )
+	{
+		fDetector->SetScoringWorld((newValue == "parallel") ?
+				PDD1DetectorConstruction::kParallel : PDD1DetectorConstruction::kMass);
+	}
+	else if( command == fPhantomCmd )
+	{
+		std::istringstream files(newValue);
+		G4String mapFilename, tableFilename;
+		files >> mapFilename >> tableFilename;
+		if (tableFilename.empty())
+		{
+			G4cerr << "Usage: /PDD1/geometry/phantom <map> <table>" << G4endl;
+			return;
+		}
+		fDetector->SetVoxelPhantom(mapFilename, tableFilename);
+	}
+	else if( command == fDensityStepCmd )
+	{
+		VoxelPhantom::densityStep = fDensityStepCmd->GetNewDoubleValue(newValue);
+	}
+	else if( command == fZEdgesCmd )
+	{
+		std::vector<G4double> edges;
+		if (!ParseLengths(newValue, edges))
+		{
+			G4cerr << "Usage: /PDD1/geometry/zBinEdges <z0> <z1> ... <zN> [unit]" << G4endl;
+			return;
+		}
+		fDetector->SetDetectorZEdges(edges);
+	}
+	else if( command == fZBinningCmd )
+	{
+		std::vector<G4double> values;
+		if (!ParseLengths(newValue, values) || values.empty() || values.size() % 2)
+		{
+			G4cerr << "Usage: /PDD1/geometry/zBinning <length> <pitch> [<length> <pitch> ...] [unit]" << G4endl;
+			return;
+		}
+		std::vector<G4double> lengths, pitches;
+		for (size_t n=0; n<values.size(); n+=2)
+		{
+			lengths.push_back(values[n]);
+			pitches.push_back(values[n+1]);
+		}
+		fDetector->SetDetectorZBinning(lengths, pitches);
+	}
+	else if( command == fCylindricalCmd )
+	{
+		std::istringstream tokens(newValue);
+		G4int nR = 0, nPhi = 0;
+		std::string radius;
+		std::getline(tokens >> nR >> nPhi, radius);
+		std::vector<G4double> values;
+		if (tokens.fail() || !ParseLengths(radius, values) || values.size() != 1)
+		{
+			G4cerr << "Usage: /PDD1/geometry/cylindricalGrid <nR> <nPhi> <radius> [unit]" << G4endl;
+			return;
+		}
+		fDetector->SetCylindricalSegmentation(values[0], nR, nPhi);
+	}
+	else if( command == fStorageCmd )
+	{
+		DetectorMatrix::storage = (newValue == "sparse") ?
+				VoxelAccumulator::kSparse : VoxelAccumulator::kDense;
+	}
+	else if( command == fLayoutCmd )
+	{
+		DetectorMatrix::layout = (newValue == "interleaved") ?
+				VoxelAccumulator::kInterleaved : VoxelAccumulator::kPlanar;
+	}
+	else if( command == fModeCmd )
+	{
+		DetectorSD::scoringMode = (newValue == "streaming") ?
+				DetectorSD::kStreaming : DetectorSD::kHits;
+	}
+	else if( command == fVerifyStoppingPowerCmd )
+	{
+		StoppingPowerTable::verifyEvery = fVerifyStoppingPowerCmd->GetNewIntValue(newValue);
+	}
+	else if( command == fFormatCmd )
+	{
+		G4int format = 0;
+		std::istringstream formats(newValue);
+		G4String token;
+		while (formats >> token)
+		{
+			if (token == "ascii") format |= DetectorMatrix::kAscii;
+			else if (token == "npy") format |= DetectorMatrix::kNpy;
+			else if (token == "coo") format |= DetectorMatrix::kCoo;
+			else if (token == "raw") format |= DetectorMatrix::kRaw;
+			else
+			{
+				G4cerr << "/PDD1/output/format: unknown format " << token << G4endl;
+				return;
+			}
+		}
+		DetectorMatrix::outputFormat = format;
+	}
+	else if( command == fSnapshotEveryCmd )
+	{
+		DetectorMatrix::snapshotEvery = fSnapshotEveryCmd->GetNewIntValue(newValue);
+	}
+	else if( command == fRunDirectoriesCmd )
+	{
+		DetectorMatrix::runDirectories = fRunDirectoriesCmd->GetNewBoolValue(newValue);
+	}
+	else if( command == fCompressCmd )
+	{
+		DetectorMatrix::compressOutput = fCompressCmd->GetNewBoolValue(newValue);
+#ifndef PDD1_USE_ZLIB
+		if (DetectorMatrix::compressOutput)
+			G4cerr << "/PDD1/output/compress: PDD1 was built without zlib, files will not be compressed" << G4endl;
+#endif
+	}
+}
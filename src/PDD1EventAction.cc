@@ -20,6 +20,7 @@
 #include "PDD1RunAction.hh"
 #include "DetectorHit.hh"
 #include "DetectorMatrix.hh"
+#include "Checkpoint.hh"
 #include "Analysis.hh"
 
 // Geant4 Headers
@@ -28,6 +29,7 @@
 #include "G4RunManager.hh"
 #include "G4SDManager.hh"
 #include "G4SystemOfUnits.hh"
+#include "G4Material.hh"
 
 PDD1EventAction::PDD1EventAction(PDD1RunAction* runAction)
 : G4UserEventAction(),
@@ -37,7 +39,8 @@ PDD1EventAction::PDD1EventAction(PDD1RunAction* runAction)
   fK30(0.),
   fK50(0.),
   fK70(0.),
-  fK90(0.)
+  fK90(0.),
+  fSteps(0)
 {
 	hitsCollectionID = -1;
 }
@@ -53,6 +56,7 @@ void PDD1EventAction::BeginOfEventAction(const G4Event*)
 	fK70=0.;
 	fK90=0.;
 	fRange=0;
+	fSteps=0;
 
 
 	G4SDManager* pSDManager = G4SDManager::GetSDMpointer();
@@ -78,6 +82,11 @@ void PDD1EventAction::EndOfEventAction(const G4Event* event)
 
 	// accumulate statistics in run action
 	fRunAction->AddEdep(fEdep);
+	fRunAction->AddSteps(fSteps);
+
+	// Count the event in the matrix (shard) of this thread
+	DetectorMatrix* matrix = DetectorMatrix::GetInstance();
+	if (matrix) matrix -> AddEvent();
 
 	G4double KineticEnergyAtVertex = event->GetPrimaryVertex()->GetPrimary()->GetKineticEnergy();
 
@@ -99,15 +108,9 @@ void PDD1EventAction::EndOfEventAction(const G4Event* event)
 		analysisManager->FillH1(5, KineticEnergyAtVertex);
 	}
 
-	if(hitsCollectionID < 0)
-		return;
 	G4HCofThisEvent* HCE = event -> GetHCofThisEvent();
 
-	// Clear voxels hit list
-	DetectorMatrix* matrix = DetectorMatrix::GetInstance();
-	if (matrix) matrix -> ClearHitTrack();
-
-	if(HCE)
+	if(HCE && hitsCollectionID >= 0)
 	{
 		PDD1HitsCollection* CHC = (PDD1HitsCollection*)(HCE -> GetHC(hitsCollectionID));
 		if(CHC)
@@ -120,41 +123,20 @@ void PDD1EventAction::EndOfEventAction(const G4Event* event)
 				size_t HitCount = CHC -> entries();
 				for (size_t h=0; h<HitCount; h++)
 				{
-					G4int i = ((*CHC)[h]) -> GetIx();
-					G4int j = ((*CHC)[h]) -> GetIy();
-					G4int k = ((*CHC)[h]) -> GetIz();
-					G4double eDep = ((*CHC)[h]) -> GetEdep();
-					G4double secondariesEDep = ((*CHC)[h]) -> GetSecondariesEdep();
-					G4double dx = ((*CHC)[h]) ->GetDX();
-					G4double kinEMean = ((*CHC)[h]) ->GetKinEMean();
-					G4int trackID = ((*CHC)[h]) -> GetTrackID();
-					G4ParticleDefinition* particleDef = ((*CHC)[h]) ->GetParticleDef();
-					G4Material* mat = ((*CHC)[h]) ->GetMat();
-					G4double vol = ((*CHC)[h]) ->GetVol();
-
-					matrix ->FillEdep(i, j, k, eDep+secondariesEDep, trackID, particleDef);
-
-					G4int Z = particleDef-> GetAtomicNumber();
-					G4int A = particleDef-> GetAtomicMass();
-					G4int PDGCode = particleDef->GetPDGEncoding();
-
-					if ( !(Z==0 && A==1) ) // All but not neutrons
-					{
-						// calculate only energy deposit
-						if( (eDep>0. || secondariesEDep>0.) && dx >0. )
-						{
-							if (PDGCode !=22 && PDGCode !=11) // not gamma and electrons
-							{
-								matrix ->FillLet(i, j, k, eDep+secondariesEDep, dx, kinEMean, trackID, particleDef, mat);
-							}
-						}
-					}
-
-					matrix ->FillFluence(i, j, k, dx, vol, trackID, particleDef);
+					const DetectorHit& hit = (*CHC)[h];
+
+					G4int i, j, k;
+					matrix ->Indices(hit.voxel, i, j, k);
+					const G4Material* mat = (*G4Material::GetMaterialTable())[hit.materialID];
+
+					matrix ->Fill(hit.speciesID, i, j, k, hit.eDep, hit.dx, hit.kinEMean, mat);
 
 				}
 			}
 		}
 	}
 
+	// Periodic checkpoint of the scored data
+	Checkpoint::EndOfEvent(matrix);
+
 }
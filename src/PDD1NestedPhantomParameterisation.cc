@@ -17,6 +17,7 @@
 
 // PDD1 Headers
 #include "PDD1NestedPhantomParameterisation.hh"
+#include "VoxelPhantom.hh"
 
 // Geant4 Headers
 #include "G4VPhysicalVolume.hh"
@@ -29,26 +30,40 @@
 PDD1NestedPhantomParameterisation
 ::PDD1NestedPhantomParameterisation(const G4ThreeVector& voxelSize,
 		G4int nz,
-		std::vector<G4Material*>& mat):
+		std::vector<G4Material*>& mat,
+		const VoxelPhantom* phantom):
 		G4VNestedParameterisation(),
 		fdX(voxelSize.x()),fdY(voxelSize.y()),fdZ(voxelSize.z()),
-		fNz(nz),fMat(mat)
+		fNz(nz),fMat(mat),fPhantom(phantom)
 {
 	// Position of voxels.
 	// x and y positions are already defined in DetectorConstruction
 	// by using replicated volume. Here only we need to define is z positions
 	// of voxles.
 	fpZ.clear();
+	fhZ.clear();
 	G4double zp;
 	for ( G4int iz = 0; iz < fNz; iz++){
 		zp = (-fNz+1+2*iz)*fdZ;
 		fpZ.push_back(zp);
+		fhZ.push_back(fdZ);
 	}
 
 }
 
+void PDD1NestedPhantomParameterisation::SetZEdges(const std::vector<G4double>& edges)
+{
+	// Centre and half length of every Z voxel, relative to the mother centre
+	G4double halfLength = (edges.back() - edges.front())/2.;
+	for ( G4int iz = 0; iz < fNz; iz++){
+		fpZ[iz] = (edges[iz] + edges[iz+1])/2. - edges.front() - halfLength;
+		fhZ[iz] = (edges[iz+1] - edges[iz])/2.;
+	}
+}
+
 PDD1NestedPhantomParameterisation::~PDD1NestedPhantomParameterisation(){
 	fpZ.clear();
+	fhZ.clear();
 }
 
 // Material assignment to geometry.
@@ -65,12 +80,10 @@ G4Material* PDD1NestedPhantomParameterisation
 	G4int ix = parentTouch->GetReplicaNumber(0);
 	G4int iy = parentTouch->GetReplicaNumber(1);
 	G4int iz = copyNo;
-	// For demonstration purpose,a couple of materials are chosen alternately.
-	G4Material* mat=0;
-	if ( ix%2 == 0 && iy%2 == 0 && iz%2 == 0 ) mat = fMat[0];
-	else mat = fMat[1];
 
-	return mat;
+	// Homogeneous detector, or the material of the phantom voxel
+	if(!fPhantom) return fMat[0];
+	return fPhantom->GetMaterial(ix + size_t(fPhantom->GetNX()) * (iy + size_t(fPhantom->GetNY()) * iz));
 }
 
 //  Number of Materials
@@ -95,11 +108,12 @@ void PDD1NestedPhantomParameterisation
 	physVol->SetTranslation(position);
 }
 
-// Dimensions are always same in this PDD1 example.
+// Dimensions are the same in X and Y, the Z length may change from voxel
+// to voxel (non-uniform depth bins).
 //
 void PDD1NestedPhantomParameterisation
-::ComputeDimensions(G4Box& box, const G4int, const G4VPhysicalVolume* ) const{
+::ComputeDimensions(G4Box& box, const G4int copyNo, const G4VPhysicalVolume* ) const{
 	box.SetXHalfLength(fdX);
 	box.SetYHalfLength(fdY);
-	box.SetZHalfLength(fdZ);
+	box.SetZHalfLength(fhZ[copyNo]);
 }
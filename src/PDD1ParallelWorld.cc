@@ -0,0 +1,62 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "PDD1ParallelWorld.hh"
+#include "PDD1DetectorConstruction.hh"
+
+// Geant4 Headers
+#include "G4Box.hh"
+#include "G4LogicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4ThreeVector.hh"
+
+PDD1ParallelWorld::PDD1ParallelWorld(const G4String& worldName, PDD1DetectorConstruction* detector)
+: G4VUserParallelWorld(worldName),
+  fDetector(detector)
+{}
+
+PDD1ParallelWorld::~PDD1ParallelWorld()
+{}
+
+void PDD1ParallelWorld::Construct()
+{
+	// Registered once, the scoring may have been moved back to the mass world
+	if (fDetector->GetScoringWorld() != PDD1DetectorConstruction::kParallel) return;
+
+	G4LogicalVolume* world_log = GetWorld()->GetLogicalVolume();
+
+	// Ghost detector, without material: the mass geometry provides it
+	G4ThreeVector detector_size = fDetector->GetDetectorSize();
+	G4Box * detector_geo
+	= new G4Box("detector",
+			detector_size.x()/2., detector_size.y()/2., detector_size.z()/2.);
+	G4LogicalVolume * detector_log
+	= new G4LogicalVolume(detector_geo, 0, "detectorScoring", 0, 0, 0);
+
+	G4ThreeVector position = fDetector->GetPhantomPosition() + fDetector->GetDetectorToPhantomPosition();
+	G4VPhysicalVolume * detector_phys =
+	new G4PVPlacement(0,				// no rotation
+			position,					// at (x,y,z)
+			detector_log,				// its logical volume
+			"detectorScoring",			// its name
+			world_log,					// its mother  volume
+			false,						// no boolean operations
+			0);							// copy number
+
+	fDetector->ConstructVoxels(detector_phys);
+}
@@ -0,0 +1,35 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "PDD1PhantomParameterisation.hh"
+#include "VoxelPhantom.hh"
+
+PDD1PhantomParameterisation::PDD1PhantomParameterisation(const VoxelPhantom* phantom, G4Material* material)
+: G4PhantomParameterisation(),
+  fPhantom(phantom),
+  fMaterial(material)
+{}
+
+PDD1PhantomParameterisation::~PDD1PhantomParameterisation()
+{}
+
+G4Material* PDD1PhantomParameterisation::ComputeMaterial(const G4int copyNo, G4VPhysicalVolume*,
+		const G4VTouchable*)
+{
+	return fPhantom ? fPhantom->GetMaterial(copyNo) : fMaterial;
+}
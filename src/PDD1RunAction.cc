@@ -20,6 +20,13 @@
 #include "PDD1PrimaryGeneratorAction.hh"
 #include "PDD1DetectorConstruction.hh"
 #include "DetectorSD.hh"
+#include "DetectorMatrix.hh"
+#include "OutputWriter.hh"
+#include "Checkpoint.hh"
+#include "PDD1RunMessenger.hh"
+#include "SecondaryNtuple.hh"
+#include "SecondaryYieldScorer.hh"
+#include "RunManifest.hh"
 #include "Analysis.hh"
 
 // Geant4 Headers
@@ -31,14 +38,23 @@
 #include "G4UnitsTable.hh"
 #include "G4SystemOfUnits.hh"
 #include "G4SDManager.hh"
+#include "G4Threading.hh"
+
+// C++ Headers
+#include <cstdio>
 
 using namespace std;
 
 PDD1RunAction::PDD1RunAction()
 : G4UserRunAction(),
   fEdep(0.),
-  fEdep2(0.)
+  fEdep2(0.),
+  fSteps(0.),
+  fMessenger(0),
+  fManifest(0)
 { 
+	// Checkpoint commands are handled by the master
+	if(G4Threading::IsMasterThread()) fMessenger = new PDD1RunMessenger();
 
 	// add new units for dose
 	//
@@ -56,6 +72,7 @@ PDD1RunAction::PDD1RunAction()
 	G4AccumulableManager* accumulableManager = G4AccumulableManager::Instance();
 	accumulableManager->RegisterAccumulable(fEdep);
 	accumulableManager->RegisterAccumulable(fEdep2);
+	accumulableManager->RegisterAccumulable(fSteps);
 
 	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
 	analysisManager->SetActivation(true);
@@ -64,17 +81,34 @@ PDD1RunAction::PDD1RunAction()
 
 PDD1RunAction::~PDD1RunAction()
 {
+	delete fMessenger;
+	delete fManifest;
+	SecondaryNtuple::ClearCache();
+	SecondaryYieldScorer::DeleteInstance();
+
+	// Worker threads own their matrix shard
+	if(!IsMaster()) DetectorMatrix::DeleteInstance();
+
 	delete G4AccumulableManager::Instance();
 	delete G4AnalysisManager::Instance();
 }
 
-void PDD1RunAction::BeginOfRunAction(const G4Run*)
+void PDD1RunAction::BeginOfRunAction(const G4Run* aRun)
 { 
+	if(IsMaster())
+	{
+		// Creates the output folder of the run
+		delete fManifest;
+		fManifest = new RunManifest(aRun);
+
+		Checkpoint::BeginOfRun(aRun->GetRunID(), aRun->GetNumberOfEventToBeProcessed());
+	}
+
 	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
 	if(analysisManager->GetActivation()){
 		G4cout << "Using " << analysisManager->GetType() << G4endl;
 		analysisManager->SetVerboseLevel(0);
-		analysisManager->SetFileName("data/PDD1");
+		analysisManager->SetFileName(DetectorMatrix::RunFolder(aRun->GetRunID()) + "/PDD1");
 
 		// Create Histograms an n-Tuples
 		CreateNTuples();
@@ -94,19 +128,84 @@ void PDD1RunAction::BeginOfRunAction(const G4Run*)
 void PDD1RunAction::EndOfRunAction(const G4Run* aRun)
 {
 	G4int nofEvents = aRun->GetNumberOfEvent();
+
+	if (fManifest) fManifest -> EndOfEventLoop(aRun);
+
 	if (nofEvents == 0) return;
 
 	// Save histograms and ntuples
 	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
 	if(analysisManager->GetActivation()){
+		// Workers' rows are merged into the master file, which holds the dictionaries
+		if(IsMaster()) SecondaryNtuple::FillDictionaries();
 		analysisManager->Write();
 		analysisManager->CloseFile();
+
+		// Single file, the workers' ntuples are merged into it
+		if(IsMaster())
+		{
+			RunManifest::AddOutput(aRun->GetRunID(),
+					analysisManager->GetFileName() + "." + analysisManager->GetFileType());
+		}
 	}
 
 	// Merge accumulables
 	G4AccumulableManager* accumulableManager = G4AccumulableManager::Instance();
 	accumulableManager->Merge();
 
+	// Merge the secondary yields: workers hand over their scorer, the master
+	// collects them all and stores the table
+	if (SecondaryYieldScorer::enabled)
+	{
+		SecondaryYieldScorer* yields = SecondaryYieldScorer::GetInstance();
+		if(!IsMaster()) yields -> ScheduleMerge();
+		else
+		{
+			yields -> MergeShards();
+			yields -> Store(aRun->GetRunID(), nofEvents);
+			yields -> Clear();
+		}
+	}
+
+	// Merge matrix shards in the same way, the master passes the run data to
+	// the background writer
+	if (DetectorMatrix* matrix = DetectorMatrix::GetInstance())
+	{
+		if(!IsMaster()) matrix -> ScheduleMerge();
+		else
+		{
+			matrix -> MergeShards();
+
+			// The checkpoint is kept until the outputs are safely on disk
+			G4int runID = aRun->GetRunID();
+			DetectorMatrix* snapshot = matrix -> Detach(runID);
+			G4String checkpoint = Checkpoint::EndOfRun();
+			OutputWriter::GetInstance() -> Submit([snapshot, checkpoint, runID]()
+			{
+				G4bool stored = snapshot -> Store();
+				const std::vector<G4String>& files = snapshot -> GetStoredFiles();
+				for (size_t f=0; f < files.size(); f++) RunManifest::AddOutput(runID, files[f]);
+
+				if (stored && !checkpoint.empty()) std::remove(checkpoint.c_str());
+				delete snapshot;
+			});
+		}
+	}
+
+	// The manifest lists the outputs, so it is written after all of them
+	if (fManifest)
+	{
+		fManifest -> SetSteps(fSteps.GetValue());
+
+		RunManifest* manifest = fManifest;
+		fManifest = 0;
+		OutputWriter::GetInstance() -> Submit([manifest]()
+		{
+			manifest -> Write();
+			delete manifest;
+		});
+	}
+
 	// Compute dose = total energy deposit in a run and its variance
 	//
 	G4double edep  = fEdep.GetValue();
@@ -133,6 +232,7 @@ void PDD1RunAction::EndOfRunAction(const G4Run* aRun)
 	if(!IsMaster()) return;
 
 	G4cout<<"Total dose: "<<G4BestUnit(dose,"Dose")<<"\t"<<"rms: "<<G4BestUnit(rmsDose,"Dose")<<G4endl;
+	G4cout<<"Steps per event: "<<fSteps.GetValue()/nofEvents<<G4endl;
 
 }
 
@@ -144,16 +244,8 @@ void PDD1RunAction::CreateNTuples(){
 	// Creating ntuples
 	analysisManager->SetFirstNtupleId(0);
 
-	// id = 0
-	analysisManager->CreateNtuple("SecondariesProduction", "Variables related to secondaries production");
-	analysisManager->SetNtupleActivation(0,true);
-	analysisManager->CreateNtupleDColumn(0,"KineticEnergyAtVertex");
-	analysisManager->CreateNtupleSColumn(0,"CreatorProcessName");
-	analysisManager->CreateNtupleSColumn(0,"CreatorModelName");
-	analysisManager->CreateNtupleSColumn(0,"ParticleName");
-	analysisManager->CreateNtupleDColumn(0,"TrackLength");
-	analysisManager->CreateNtupleDColumn(0,"TotalEnergyDeposit");
-	analysisManager->FinishNtuple();
+	// id = 0: SecondariesProduction, id = 1-3: its Processes, Models and Particles dictionaries
+	SecondaryNtuple::Book();
 
 }
 
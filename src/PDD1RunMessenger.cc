@@ -0,0 +1,157 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "PDD1RunMessenger.hh"
+#include "Checkpoint.hh"
+#include "SecondaryNtuple.hh"
+#include "SecondaryYieldScorer.hh"
+
+// Geant4 Headers
+#include "G4UIdirectory.hh"
+#include "G4UIcmdWithAString.hh"
+#include "G4UIcmdWithAnInteger.hh"
+#include "G4UIcmdWithADouble.hh"
+#include "G4UIcmdWithABool.hh"
+#include "G4RunManager.hh"
+
+PDD1RunMessenger::PDD1RunMessenger()
+: G4UImessenger()
+{
+	fRunDirectory = new G4UIdirectory("/PDD1/run/");
+	fRunDirectory->SetGuidance("Checkpoint and resume of the scoring matrix.");
+
+	fCheckpointEveryCmd = new G4UIcmdWithAnInteger("/PDD1/run/checkpointEvery",this);
+	fCheckpointEveryCmd->SetGuidance("Write a checkpoint every N events (0 disables it).");
+	fCheckpointEveryCmd->SetParameterName("N",false);
+	fCheckpointEveryCmd->SetRange("N>=0");
+	fCheckpointEveryCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fCheckpointEveryCmd->SetToBeBroadcasted(false);
+
+	fCheckpointMinutesCmd = new G4UIcmdWithADouble("/PDD1/run/checkpointMinutes",this);
+	fCheckpointMinutesCmd->SetGuidance("Write a checkpoint every T minutes (0 disables it).");
+	fCheckpointMinutesCmd->SetParameterName("T",false);
+	fCheckpointMinutesCmd->SetRange("T>=0");
+	fCheckpointMinutesCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fCheckpointMinutesCmd->SetToBeBroadcasted(false);
+
+	fCheckpointFileCmd = new G4UIcmdWithAString("/PDD1/run/checkpointFile",this);
+	fCheckpointFileCmd->SetGuidance("Checkpoint file, removed when the run completes.");
+	fCheckpointFileCmd->SetParameterName("file",false);
+	fCheckpointFileCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fCheckpointFileCmd->SetToBeBroadcasted(false);
+
+	fResumeCmd = new G4UIcmdWithAString("/PDD1/run/resume",this);
+	fResumeCmd->SetGuidance("Load a checkpoint and simulate the events left in its run.");
+	fResumeCmd->SetGuidance("Sequential runs continue exactly; multi-threaded runs simulate new");
+	fResumeCmd->SetGuidance("independent events, which is only statistically equivalent.");
+	fResumeCmd->SetParameterName("file",false);
+	fResumeCmd->AvailableForStates(G4State_Idle);
+	fResumeCmd->SetToBeBroadcasted(false);
+
+	fSecondariesDirectory = new G4UIdirectory("/PDD1/secondaries/");
+	fSecondariesDirectory->SetGuidance("SecondariesProduction ntuple control.");
+
+	fSampleEveryCmd = new G4UIcmdWithAnInteger("/PDD1/secondaries/sampleEvery",this);
+	fSampleEveryCmd->SetGuidance("Store one in every N tracks which pass the filters.");
+	fSampleEveryCmd->SetParameterName("N",false);
+	fSampleEveryCmd->SetRange("N>=1");
+	fSampleEveryCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fSampleEveryCmd->SetToBeBroadcasted(false);
+
+	fParticlesCmd = new G4UIcmdWithAString("/PDD1/secondaries/particles",this);
+	fParticlesCmd->SetGuidance("Space separated list of the particles to store (no argument: all).");
+	fParticlesCmd->SetParameterName("particles",true);
+	fParticlesCmd->SetDefaultValue("");
+	fParticlesCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fParticlesCmd->SetToBeBroadcasted(false);
+
+	fCreatorsCmd = new G4UIcmdWithAString("/PDD1/secondaries/creators",this);
+	fCreatorsCmd->SetGuidance("Space separated list of the creator processes to store, gun for");
+	fCreatorsCmd->SetGuidance("the primaries (no argument: all).");
+	fCreatorsCmd->SetParameterName("processes",true);
+	fCreatorsCmd->SetDefaultValue("");
+	fCreatorsCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fCreatorsCmd->SetToBeBroadcasted(false);
+
+	fYieldsCmd = new G4UIcmdWithABool("/PDD1/secondaries/yields",this);
+	fYieldsCmd->SetGuidance("Score the aggregated yields, energy and track length spectra of the");
+	fYieldsCmd->SetGuidance("secondaries by creator process and model (SecondaryYields.out).");
+	fYieldsCmd->SetParameterName("yields",true);
+	fYieldsCmd->SetDefaultValue(true);
+	fYieldsCmd->AvailableForStates(G4State_PreInit,G4State_Idle);
+	fYieldsCmd->SetToBeBroadcasted(false);
+}
+
+PDD1RunMessenger::~PDD1RunMessenger()
+{
+	delete fYieldsCmd;
+	delete fCreatorsCmd;
+	delete fParticlesCmd;
+	delete fSampleEveryCmd;
+	delete fSecondariesDirectory;
+	delete fResumeCmd;
+	delete fCheckpointFileCmd;
+	delete fCheckpointMinutesCmd;
+	delete fCheckpointEveryCmd;
+	delete fRunDirectory;
+}
+
+void PDD1RunMessenger::SetNewValue(G4UIcommand* command, G4String newValue)
+{
+	if( command == fCheckpointEveryCmd )
+	{
+		Checkpoint::everyEvents = fCheckpointEveryCmd->GetNewIntValue(newValue);
+	}
+	else if( command == fCheckpointMinutesCmd )
+	{
+		Checkpoint::everyMinutes = fCheckpointMinutesCmd->GetNewDoubleValue(newValue);
+	}
+	else if( command == fCheckpointFileCmd )
+	{
+		Checkpoint::filename = newValue;
+	}
+	else if( command == fSampleEveryCmd )
+	{
+		SecondaryNtuple::sampleEvery = fSampleEveryCmd->GetNewIntValue(newValue);
+	}
+	else if( command == fParticlesCmd )
+	{
+		SecondaryNtuple::SetParticleFilter(newValue);
+	}
+	else if( command == fCreatorsCmd )
+	{
+		SecondaryNtuple::SetCreatorFilter(newValue);
+	}
+	else if( command == fYieldsCmd )
+	{
+		SecondaryYieldScorer::enabled = fYieldsCmd->GetNewBoolValue(newValue);
+	}
+	else if( command == fResumeCmd )
+	{
+		G4long remaining = Checkpoint::Resume(newValue);
+		if (remaining < 0)
+		{
+			G4cerr << "/PDD1/run/resume: cannot read the checkpoint " << newValue << G4endl;
+			return;
+		}
+
+		G4cout << "Resuming from " << newValue << ": " << remaining << " events left" << G4endl;
+		if (remaining > 0) G4RunManager::GetRunManager()->BeamOn(remaining);
+	}
+}
@@ -39,6 +39,8 @@ PDD1SteppingAction::~PDD1SteppingAction()
 
 void PDD1SteppingAction::UserSteppingAction(const G4Step* aStep)
 {
+	// Every step is counted, the navigation cost depends on the voxelisation
+	fEventAction->AddStep();
 
 	if (fScoringVolumeVector.empty()) {
 		const PDD1DetectorConstruction* detectorConstruction
@@ -23,6 +23,8 @@
 // PDD1 Headers
 #include "PDD1TrackingAction.hh"
 #include "Analysis.hh"
+#include "SecondaryNtuple.hh"
+#include "SecondaryYieldScorer.hh"
 
 using namespace std;
 
@@ -43,35 +45,15 @@ void PDD1TrackingAction::PreUserTrackingAction (const G4Track* /*aTrack*/)
 void PDD1TrackingAction::PostUserTrackingAction (const G4Track* aTrack){
 
 	// Analysis manager
-
 	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
 
-	G4String CreatorProcessName;
-	G4String CreatorModelName ;
-
-	if(aTrack -> GetCreatorProcess ()!=0){
-		CreatorProcessName = aTrack -> GetCreatorProcess() -> GetProcessName() ;
-		CreatorModelName = aTrack ->GetCreatorModelName();
-		if(CreatorModelName=="Undefined"){
-			CreatorModelName="u_"+CreatorProcessName;
-		}
-	}else{
-		CreatorProcessName = "gun" ;
-		CreatorModelName = "gun";
+	if(analysisManager->GetActivation()){
+		SecondaryNtuple::Fill(aTrack, fTotalEdep);
 	}
 
-	G4double KineticEnergyAtVertex 		= aTrack->GetVertexKineticEnergy();
-	G4String ParticleName 				= aTrack->GetParticleDefinition()-> GetParticleName();
-	G4double TrackLength		 		= aTrack->GetTrackLength();
-
-	if(analysisManager->GetActivation()){
-		analysisManager->FillNtupleDColumn(0,0,KineticEnergyAtVertex);
-		analysisManager->FillNtupleSColumn(0,1,CreatorProcessName);
-		analysisManager->FillNtupleSColumn(0,2,CreatorModelName);
-		analysisManager->FillNtupleSColumn(0,3,ParticleName);
-		analysisManager->FillNtupleDColumn(0,4,TrackLength);
-		analysisManager->FillNtupleDColumn(0,5,fTotalEdep);
-		analysisManager->AddNtupleRow(0);
+	// Aggregated yields and spectra, independent of the analysis manager
+	if(SecondaryYieldScorer::enabled){
+		SecondaryYieldScorer::GetInstance()->Fill(aTrack);
 	}
 
 	if(aTrack->GetTrackID()==1){
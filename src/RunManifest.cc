@@ -0,0 +1,408 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "RunManifest.hh"
+#include "DetectorMatrix.hh"
+#include "PDD1DetectorConstruction.hh"
+#include "VoxelPhantom.hh"
+
+// Geant4 Headers
+#include "G4AutoLock.hh"
+#include "G4Run.hh"
+#include "G4RunManager.hh"
+#include "G4UImanager.hh"
+#include "G4VModularPhysicsList.hh"
+#include "G4Material.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+
+// C++ Headers
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdint.h>
+#include <sys/resource.h>
+
+G4long RunManifest::seed = 0;
+G4int RunManifest::maxCommands = 1000000;
+G4double RunManifest::lastWall = 0.;
+G4double RunManifest::lastCpu = 0.;
+G4String RunManifest::resumeCheckpoint;
+G4long RunManifest::resumeEvents = 0;
+G4long RunManifest::resumeTarget = 0;
+G4long RunManifest::resumeSeed = 0;
+
+namespace
+{
+	// Files written for every run whose manifest is still to be written
+	G4Mutex outputsMutex = G4MUTEX_INITIALIZER;
+	std::map<G4int, std::vector<G4String> > runOutputs;
+
+	std::string JsonString(const G4String& value)
+	{
+		std::string quoted = "\"";
+		for (size_t c=0; c<value.size(); c++)
+		{
+			if (value[c] == '"' || value[c] == '\\') quoted += '\\';
+			if (value[c] == '\n') quoted += "\\n";
+			else if (value[c] == '\t') quoted += "\\t";
+			else if ((unsigned char)(value[c]) >= 0x20) quoted += value[c];
+		}
+		return quoted + "\"";
+	}
+
+	std::string JsonVector(const G4ThreeVector& value, G4double unit)
+	{
+		std::ostringstream vector;
+		vector << "[" << value.x()/unit << ", " << value.y()/unit << ", " << value.z()/unit << "]";
+		return vector.str();
+	}
+
+	// Depth bin edges in mm, null when the bins are uniform
+	std::string JsonEdges(const std::vector<G4double>& edges)
+	{
+		if (edges.empty()) return "null";
+		std::ostringstream json;
+		json << "[";
+		for (size_t n=0; n<edges.size(); n++) json << (n ? ", " : "") << edges[n]/mm;
+		json << "]";
+		return json.str();
+	}
+
+	std::string JsonMaterial(const G4Material* material)
+	{
+		if (!material) return "null";
+		std::ostringstream json;
+		json << "{\"name\": " << JsonString(material->GetName())
+				<< ", \"density_g_cm3\": " << material->GetDensity()/(g/cm3) << "}";
+		return json.str();
+	}
+
+	// Unknown or not uniform values are null
+	std::string JsonPositive(G4double value)
+	{
+		if (value <= 0.) return "null";
+		std::ostringstream json;
+		json << value;
+		return json.str();
+	}
+
+	std::string JsonTiming(G4double wall, G4double cpu)
+	{
+		std::ostringstream json;
+		json << "{\"wall_s\": " << wall << ", \"cpu_s\": " << cpu << "}";
+		return json.str();
+	}
+
+	// CRC-32 (IEEE 802.3) of a file, false if it cannot be read
+	G4bool Crc32(const std::string& filename, uint32_t& crc)
+	{
+		static uint32_t table[256];
+		static G4bool tableReady = false;
+		if (!tableReady)
+		{
+			for (uint32_t n=0; n<256; n++)
+			{
+				uint32_t c = n;
+				for (G4int k=0; k<8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				table[n] = c;
+			}
+			tableReady = true;
+		}
+
+		std::ifstream in(filename, std::ios::in | std::ios::binary);
+		if (!in) return false;
+
+		std::vector<char> buffer(1 << 20);
+		crc = 0xFFFFFFFFu;
+		while (in)
+		{
+			in.read(buffer.data(), buffer.size());
+			std::streamsize n = in.gcount();
+			for (std::streamsize b=0; b<n; b++)
+				crc = table[(crc ^ (unsigned char)(buffer[b])) & 0xFF] ^ (crc >> 8);
+		}
+		crc ^= 0xFFFFFFFFu;
+		return true;
+	}
+}
+
+void RunManifest::Start()
+{
+	lastWall = WallTime();
+	lastCpu = CpuTime();
+
+	// G4UImanager only keeps the last 20 commands by default, which loses the
+	// beam settings of a long macro
+	G4UImanager::GetUIpointer() -> SetMaxHistSize(maxCommands);
+}
+
+G4double RunManifest::WallTime()
+{
+	return std::chrono::duration<G4double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+G4double RunManifest::CpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+			+ 1.e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+RunManifest::RunManifest(const G4Run* aRun)
+: fRunID(aRun->GetRunID()),
+  fFolder(DetectorMatrix::RunFolder(aRun->GetRunID())),
+  fEventsRequested(aRun->GetNumberOfEventToBeProcessed()),
+  fEvents(0),
+  fResumedEvents(0),
+  fSteps(0.),
+  fLoopEndWall(0.),
+  fLoopEndCpu(0.)
+{
+	fLoopWall = WallTime();
+	fLoopCpu = CpuTime();
+	fSetupWall = fLoopWall - lastWall;
+	fSetupCpu = fLoopCpu - lastCpu;
+
+	std::error_code error;
+	std::filesystem::create_directories(std::string(fFolder), error);
+	if (error)
+	{
+		G4Exception("RunManifest::RunManifest()", "PDD1002", JustWarning,
+				("Cannot create the output folder " + fFolder).c_str());
+	}
+
+	// Random engine state at the beginning of the run
+	std::ostringstream engine;
+	G4Random::getTheEngine() -> put(engine);
+	fEngineState = engine.str();
+
+	G4RunManager* runManager = G4RunManager::GetRunManager();
+	std::ostringstream json;
+
+	const PDD1DetectorConstruction* detector
+	= static_cast<const PDD1DetectorConstruction*>(runManager->GetUserDetectorConstruction());
+	if (detector)
+	{
+		G4int nX, nY, nZ;
+		detector->GetDetectorSegmentation(nX, nY, nZ);
+
+		json << "  \"geometry\": {\n"
+				<< "    \"phantom_size_mm\": " << JsonVector(detector->GetPhantomSize(), mm) << ",\n"
+				<< "    \"phantom_position_mm\": " << JsonVector(detector->GetPhantomPosition(), mm) << ",\n"
+				<< "    \"detector_size_mm\": " << JsonVector(detector->GetDetectorSize(), mm) << ",\n"
+				<< "    \"detector_to_phantom_position_mm\": " << JsonVector(detector->GetDetectorToPhantomPosition(), mm) << ",\n"
+				<< "    \"segmentation\": [" << nX << ", " << nY << ", " << nZ << "],\n"
+				<< "    \"z_edges_mm\": " << JsonEdges(detector->GetDetectorZEdges()) << ",\n"
+				<< "    \"grid\": " << JsonString(detector->GetScoringRadius() > 0. ? "cylindrical" : "cartesian") << ",\n"
+				<< "    \"scoring_radius_mm\": " << detector->GetScoringRadius()/mm << ",\n"
+				<< "    \"voxelisation\": " << JsonString(detector->GetVoxelisationName()) << ",\n"
+				<< "    \"voxel_phantom\": " << JsonString(detector->GetVoxelPhantomFile()) << ",\n"
+				<< "    \"scoring_world\": " << JsonString(detector->GetScoringWorld() == PDD1DetectorConstruction::kParallel ? "parallel" : "mass") << ",\n"
+				<< "    \"voxel_mass_kg\": " << JsonPositive(detector->GetMassOfVoxel()/kg) << ",\n"
+				<< "    \"voxel_volume_cm3\": " << detector->GetVolumeOfVoxel()/cm3 << "\n"
+				<< "  },\n";
+		json << "  \"materials\": {\"phantom\": " << JsonMaterial(detector->GetPhantomMaterial())
+				<< ", \"detector\": " << JsonMaterial(detector->GetDetectorMaterial());
+
+		// Voxel phantom: the materials in index order, with the mass of a voxel
+		// of each, to convert the energy deposit of a voxel to dose
+		if (const VoxelPhantom* phantom = detector->GetVoxelPhantom())
+		{
+			const std::vector<G4Material*>& materials = phantom->GetMaterials();
+			json << ",\n    \"voxel_phantom\": [";
+			for (size_t m=0; m < materials.size(); m++)
+			{
+				json << (m ? ",\n      " : "\n      ") << "{\"name\": " << JsonString(materials[m]->GetName())
+						<< ", \"density_g_cm3\": " << materials[m]->GetDensity()/(g/cm3)
+						<< ", \"voxel_mass_kg\": " << materials[m]->GetDensity() * detector->GetVolumeOfVoxel()/kg << "}";
+			}
+			json << "\n    ]";
+		}
+		json << "},\n";
+	}
+
+	json << "  \"physics\": [";
+	const G4VModularPhysicsList* physicsList
+	= dynamic_cast<const G4VModularPhysicsList*>(runManager->GetUserPhysicsList());
+	for (G4int p=0; physicsList && physicsList->GetPhysics(p); p++)
+	{
+		json << (p ? ", " : "") << JsonString(physicsList->GetPhysics(p)->GetPhysicsName());
+	}
+	json << "],\n";
+
+	json << "  \"threads\": " << runManager->GetNumberOfThreads() << ",\n";
+	json << "  \"random\": {\"seed\": " << seed << ", \"engine\": " << JsonString(G4Random::getTheEngine()->name())
+			<< ", \"state\": " << JsonString(fEngineState) << "},\n";
+
+	// Resumed run: the events and the target are those of the checkpointed run
+	if (!resumeCheckpoint.empty())
+	{
+		fResumedEvents = resumeEvents;
+		fEventsRequested = resumeTarget;
+		json << "  \"resume\": {\"checkpoint\": " << JsonString(resumeCheckpoint)
+				<< ", \"events\": " << resumeEvents << ", \"events_requested\": " << resumeTarget
+				<< ", \"seed\": ";
+		if (resumeSeed > 0) json << resumeSeed;
+		else json << "null";
+		json << "},\n";
+		resumeCheckpoint = "";
+	}
+	else
+	{
+		json << "  \"resume\": null,\n";
+	}
+
+	fConfiguration = json.str();
+}
+
+void RunManifest::EndOfEventLoop(const G4Run* aRun)
+{
+	fEvents = fResumedEvents + aRun->GetNumberOfEvent();
+
+	fLoopEndWall = WallTime();
+	fLoopEndCpu = CpuTime();
+	lastWall = fLoopEndWall;
+	lastCpu = fLoopEndCpu;
+
+	// Every command applied so far, beam settings included
+	G4UImanager* UImanager = G4UImanager::GetUIpointer();
+	fCommands.clear();
+	for (G4int c=0; c < UImanager->GetNumberOfHistory(); c++)
+	{
+		fCommands.push_back(UImanager->GetPreviousCommand(c));
+	}
+}
+
+void RunManifest::AddOutput(G4int runID, const G4String& filename)
+{
+	G4AutoLock lock(&outputsMutex);
+	runOutputs[runID].push_back(filename);
+}
+
+void RunManifest::SetResume(const G4String& checkpoint, G4long events, G4long target, G4long seed)
+{
+	resumeCheckpoint = checkpoint;
+	resumeEvents = events;
+	resumeTarget = target;
+	resumeSeed = seed;
+}
+
+void RunManifest::Write()
+{
+	G4double outputWall = WallTime() - fLoopEndWall;
+	G4double outputCpu = CpuTime() - fLoopEndCpu;
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	G4double peakMemory = usage.ru_maxrss / 1048576.;
+#else
+	G4double peakMemory = usage.ru_maxrss / 1024.;
+#endif
+
+	G4String manifestFilename = DetectorMatrix::RunFilename(fRunID, "manifest", ".json");
+
+	// Outputs of this run, as recorded by the code which wrote them
+	std::vector<std::string> outputs;
+	{
+		G4AutoLock lock(&outputsMutex);
+		const std::vector<G4String>& files = runOutputs[fRunID];
+		const std::string prefix = std::string(fFolder) + "/";
+		for (size_t f=0; f < files.size(); f++)
+		{
+			if (files[f].compare(0, prefix.size(), prefix) != 0) continue;
+			outputs.push_back(files[f].substr(prefix.size()));
+		}
+		runOutputs.erase(fRunID);
+	}
+	std::sort(outputs.begin(), outputs.end());
+	outputs.erase(std::unique(outputs.begin(), outputs.end()), outputs.end());
+
+	// Flat output layout: the manifest of another job is kept
+	std::error_code existsError;
+	if (std::filesystem::exists(std::string(manifestFilename), existsError))
+	{
+		G4Exception("RunManifest::Write()", "PDD1002", JustWarning,
+				(manifestFilename + " already exists, it is not overwritten").c_str());
+		return;
+	}
+
+	std::ofstream json(manifestFilename, std::ios::out);
+	if (!json)
+	{
+		G4Exception("RunManifest::Write()", "PDD1002", JustWarning,
+				("Cannot open " + manifestFilename).c_str());
+		return;
+	}
+
+	json << "{\n";
+	json << "  \"run\": " << fRunID << ",\n";
+	json << "  \"events\": " << fEvents << ",\n";
+	json << "  \"events_requested\": " << fEventsRequested << ",\n";
+	json << "  \"steps\": " << G4long(fSteps) << ",\n";
+	json << fConfiguration;
+
+	json << "  \"beam\": [";
+	G4int nBeam = 0;
+	for (size_t c=0; c < fCommands.size(); c++)
+	{
+		if (fCommands[c].compare(0, 5, "/gps/") != 0) continue;
+		json << (nBeam++ ? ", " : "") << JsonString(fCommands[c]);
+	}
+	json << "],\n";
+
+	json << "  \"timing\": {\n"
+			<< "    \"setup\": " << JsonTiming(fSetupWall, fSetupCpu) << ",\n"
+			<< "    \"event_loop\": " << JsonTiming(fLoopEndWall - fLoopWall, fLoopEndCpu - fLoopCpu) << ",\n"
+			<< "    \"output\": " << JsonTiming(outputWall, outputCpu) << "\n"
+			<< "  },\n";
+	json << "  \"peak_memory_mb\": " << peakMemory << ",\n";
+
+	json << "  \"commands\": [";
+	for (size_t c=0; c < fCommands.size(); c++)
+	{
+		json << (c ? ",\n    " : "\n    ") << JsonString(fCommands[c]);
+	}
+	json << "\n  ],\n";
+
+	// Files are listed relative to the manifest
+	json << "  \"outputs\": [";
+	G4int nOutputs = 0;
+	for (size_t f=0; f < outputs.size(); f++)
+	{
+		std::string path = std::string(fFolder) + "/" + outputs[f];
+		uint32_t crc = 0;
+		if (!Crc32(path, crc)) continue;
+
+		std::error_code sizeError;
+		uintmax_t bytes = std::filesystem::file_size(path, sizeError);
+		char crcText[9];
+		std::snprintf(crcText, sizeof(crcText), "%08x", crc);
+
+		json << (nOutputs++ ? ",\n    " : "\n    ") << "{\"file\": " << JsonString(outputs[f])
+				<< ", \"bytes\": " << (sizeError ? 0 : bytes) << ", \"crc32\": \"" << crcText << "\"}";
+	}
+	json << "\n  ]\n}\n";
+}
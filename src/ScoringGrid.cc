@@ -0,0 +1,305 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "ScoringGrid.hh"
+
+// Geant4 Headers
+#include "G4SystemOfUnits.hh"
+
+// C++ Headers
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	// Segments shorter than this are left out: a step that starts or ends on
+	// a voxel wall would otherwise leave a sliver in the neighbouring voxel
+	const G4double kSliver = 1.e-9 * mm;
+}
+
+ScoringGrid::ScoringGrid()
+: fRotated(false),
+  fNX(1),
+  fNY(1),
+  fNZ(1),
+  fCylindrical(false),
+  fRadius(0.)
+{}
+
+ScoringGrid::ScoringGrid(const G4ThreeVector& center, const G4ThreeVector& size, G4int nX, G4int nY, G4int nZ,
+		const G4RotationMatrix& rotation)
+: fCenter(center),
+  fHalfSize(size * 0.5),
+  fPitch(size.x() / nX, size.y() / nY, size.z() / nZ),
+  fInversePitch(nX / size.x(), nY / size.y(), nZ / size.z()),
+  fInverseRotation(rotation.inverse()),
+  fRotated(!rotation.isIdentity()),
+  fNX(nX),
+  fNY(nY),
+  fNZ(nZ),
+  fCylindrical(false),
+  fRadius(0.)
+{}
+
+ScoringGrid::ScoringGrid(const G4ThreeVector& center, const G4ThreeVector& size, G4int nX, G4int nY,
+		const std::vector<G4double>& edgesZ, const G4RotationMatrix& rotation)
+: fCenter(center),
+  fHalfSize(size * 0.5),
+  fPitch(size.x() / nX, size.y() / nY, size.z() / (edgesZ.size() - 1)),
+  fInversePitch(nX / size.x(), nY / size.y(), (edgesZ.size() - 1) / size.z()),
+  fInverseRotation(rotation.inverse()),
+  fRotated(!rotation.isIdentity()),
+  fNX(nX),
+  fNY(nY),
+  fNZ(edgesZ.size() - 1),
+  fEdgesZ(edgesZ),
+  fCylindrical(false),
+  fRadius(0.)
+{}
+
+ScoringGrid ScoringGrid::Cylinder(const G4ThreeVector& center, G4double radius, G4int nR, G4int nPhi,
+		G4double length, G4int nZ, const std::vector<G4double>& edgesZ, const G4RotationMatrix& rotation)
+{
+	// Depth bins of the box around the cylinder, then radial and azimuthal bins
+	G4ThreeVector size(2. * radius, 2. * radius, length);
+	ScoringGrid grid = edgesZ.empty() ? ScoringGrid(center, size, nR, nPhi, nZ, rotation)
+			: ScoringGrid(center, size, nR, nPhi, edgesZ, rotation);
+
+	grid.fCylindrical = true;
+	grid.fRadius = radius;
+	grid.fPitch.setX(radius / nR);
+	grid.fPitch.setY(twopi / nPhi);
+	grid.fInversePitch.setX(nR / radius);
+	grid.fInversePitch.setY(nPhi / twopi);
+	return grid;
+}
+
+void ScoringGrid::Traverse(const G4ThreeVector& start, const G4ThreeVector& end, std::vector<Segment>& segments) const
+{
+	segments.clear();
+
+	G4ThreeVector origin = ToGrid(start);
+	G4ThreeVector direction = ToGrid(end) - origin;
+	G4double length = direction.mag();
+	if (length <= kSliver) return;
+
+	if (fCylindrical)
+	{
+		TraverseCylinder(origin, direction, segments);
+		return;
+	}
+
+	const G4int n[3] = { fNX, fNY, fNZ };
+
+	// Clip the segment, origin + t*direction with t in [0,1], to the grid
+	G4double tEnter = 0., tExit = 1.;
+	for (G4int axis=0; axis<3; axis++)
+	{
+		G4double size = 2. * fHalfSize[axis];
+		if (direction[axis] == 0.)
+		{
+			if (origin[axis] < 0. || origin[axis] > size) return;
+			continue;
+		}
+		G4double t0 = -origin[axis] / direction[axis];
+		G4double t1 = (size - origin[axis]) / direction[axis];
+		if (t0 > t1) std::swap(t0, t1);
+		tEnter = std::max(tEnter, t0);
+		tExit = std::min(tExit, t1);
+	}
+	if ((tExit - tEnter) * length <= kSliver) return;
+
+	// Voxel of the entry point, distance (in t) to its next wall on every
+	// axis and between two walls
+	G4ThreeVector entry = origin + direction * tEnter;
+	G4int voxel[3], step[3];
+	G4double tNext[3], tDelta[3];
+	for (G4int axis=0; axis<3; axis++)
+	{
+		voxel[axis] = (axis == 2) ? LocateZ(entry[axis]) : G4int(std::floor(entry[axis] * fInversePitch[axis]));
+		voxel[axis] = std::min(std::max(voxel[axis], 0), n[axis] - 1);
+
+		if (direction[axis] > 0.)
+		{
+			step[axis] = 1;
+			tNext[axis] = (Wall(axis, voxel[axis] + 1) - origin[axis]) / direction[axis];
+			tDelta[axis] = fPitch[axis] / direction[axis];
+		}
+		else if (direction[axis] < 0.)
+		{
+			step[axis] = -1;
+			tNext[axis] = (Wall(axis, voxel[axis]) - origin[axis]) / direction[axis];
+			tDelta[axis] = -fPitch[axis] / direction[axis];
+		}
+		else
+		{
+			step[axis] = 0;
+			tNext[axis] = std::numeric_limits<G4double>::infinity();
+			tDelta[axis] = std::numeric_limits<G4double>::infinity();
+		}
+	}
+
+	// Walk from wall to wall
+	G4double t = tEnter;
+	while (t < tExit)
+	{
+		G4int axis = (tNext[0] < tNext[1]) ? ((tNext[0] < tNext[2]) ? 0 : 2) : ((tNext[1] < tNext[2]) ? 1 : 2);
+		G4double tWall = std::min(tNext[axis], tExit);
+
+		if ((tWall - t) * length > kSliver)
+		{
+			Segment segment = { voxel[0], voxel[1], voxel[2], (tWall - t) * length, t * length };
+			segments.push_back(segment);
+		}
+
+		t = tWall;
+		voxel[axis] += step[axis];
+		if (voxel[axis] < 0 || voxel[axis] >= n[axis]) break;
+
+		// Non-uniform depth bins: the next wall is not a pitch away
+		if (axis == 2 && !fEdgesZ.empty())
+			tNext[axis] = (Wall(axis, voxel[axis] + (step[axis] > 0 ? 1 : 0)) - origin[axis]) / direction[axis];
+		else
+			tNext[axis] += tDelta[axis];
+	}
+}
+
+// The segment is cut at every crossing with a bin boundary (cylinders of the
+// radial bins, half-planes of the azimuthal bins, depth planes) and every
+// piece is given to the bin of its midpoint. Only the boundaries within the
+// radial, azimuthal and depth range of the segment are tried.
+void ScoringGrid::TraverseCylinder(const G4ThreeVector& origin, const G4ThreeVector& direction,
+		std::vector<Segment>& segments) const
+{
+	G4double length = direction.mag();
+
+	// Transverse position relative to the axis: p(t) = (x0 + t*dx, y0 + t*dy)
+	G4double x0 = origin.x() - fHalfSize.x(), y0 = origin.y() - fHalfSize.y();
+	G4double dx = direction.x(), dy = direction.y();
+	G4double a = dx * dx + dy * dy;
+	G4double b = x0 * dx + y0 * dy;
+	G4double c = x0 * x0 + y0 * y0;
+
+	// Clip to the depth range and to the outer cylinder
+	G4double tEnter = 0., tExit = 1.;
+	G4double depth = 2. * fHalfSize.z();
+	if (direction.z() == 0.)
+	{
+		if (origin.z() < 0. || origin.z() > depth) return;
+	}
+	else
+	{
+		G4double t0 = -origin.z() / direction.z();
+		G4double t1 = (depth - origin.z()) / direction.z();
+		if (t0 > t1) std::swap(t0, t1);
+		tEnter = std::max(tEnter, t0);
+		tExit = std::min(tExit, t1);
+	}
+	if (a == 0.)
+	{
+		if (c > fRadius * fRadius) return;
+	}
+	else
+	{
+		G4double discriminant = b * b - a * (c - fRadius * fRadius);
+		if (discriminant <= 0.) return;
+		G4double root = std::sqrt(discriminant);
+		tEnter = std::max(tEnter, (-b - root) / a);
+		tExit = std::min(tExit, (-b + root) / a);
+	}
+	if ((tExit - tEnter) * length <= kSliver) return;
+
+	std::vector<G4double> cuts;
+	cuts.push_back(tEnter);
+
+	// Radial boundaries between the smallest and largest radius of the segment
+	if (a > 0.)
+	{
+		G4double tClosest = std::min(std::max(-b / a, tEnter), tExit);
+		G4double r2Min = c + tClosest * (2. * b + tClosest * a);
+		G4double r2Enter = c + tEnter * (2. * b + tEnter * a);
+		G4double r2Exit = c + tExit * (2. * b + tExit * a);
+		G4int nLow = std::max(1, G4int(std::ceil(std::sqrt(std::max(r2Min, 0.)) * fInversePitch.x())));
+		G4int nHigh = std::min(fNX - 1, G4int(std::sqrt(std::max(r2Enter, r2Exit)) * fInversePitch.x()));
+		for (G4int n = nLow; n <= nHigh; n++)
+		{
+			G4double r = n * fPitch.x();
+			G4double discriminant = b * b - a * (c - r * r);
+			if (discriminant <= 0.) continue;
+			G4double root = std::sqrt(discriminant);
+			for (G4int s = -1; s <= 1; s += 2)
+			{
+				G4double t = (-b + s * root) / a;
+				if (t > tEnter && t < tExit) cuts.push_back(t);
+			}
+		}
+	}
+
+	// Azimuthal boundaries: half-planes from the axis at angle m * pitch
+	if (fNY > 1 && a > 0.)
+	{
+		for (G4int m = 0; m < fNY; m++)
+		{
+			G4double phi = m * fPitch.y();
+			G4double cosPhi = std::cos(phi), sinPhi = std::sin(phi);
+			G4double normal = dy * cosPhi - dx * sinPhi;
+			if (normal == 0.) continue;
+			G4double t = (x0 * sinPhi - y0 * cosPhi) / normal;
+			if (t <= tEnter || t >= tExit) continue;
+			if ((x0 + t * dx) * cosPhi + (y0 + t * dy) * sinPhi > 0.) cuts.push_back(t);
+		}
+	}
+
+	// Depth boundaries
+	if (direction.z() != 0.)
+	{
+		G4double zEnter = origin.z() + tEnter * direction.z();
+		G4double zExit = origin.z() + tExit * direction.z();
+		G4int nLow = std::max(1, LocateZ(std::min(zEnter, zExit)) + 1);
+		G4int nHigh = std::min(fNZ - 1, LocateZ(std::max(zEnter, zExit)));
+		for (G4int n = nLow; n <= nHigh; n++)
+		{
+			G4double t = (Wall(2, n) - origin.z()) / direction.z();
+			if (t > tEnter && t < tExit) cuts.push_back(t);
+		}
+	}
+
+	cuts.push_back(tExit);
+	std::sort(cuts.begin() + 1, cuts.end() - 1);
+
+	// Pieces between consecutive cuts, joined while they stay in the same bin
+	for (size_t n = 1; n < cuts.size(); n++)
+	{
+		G4double pieceLength = (cuts[n] - cuts[n-1]) * length;
+		if (pieceLength <= kSliver) continue;
+
+		G4ThreeVector middle = origin + direction * (0.5 * (cuts[n] + cuts[n-1]));
+		Segment segment;
+		LocateCylinder(middle, segment.i, segment.j);
+		segment.k = std::min(std::max(LocateZ(middle.z()), 0), fNZ - 1);
+		segment.i = std::min(segment.i, fNX - 1);
+		segment.length = pieceLength;
+		segment.start = cuts[n-1] * length;
+
+		if (!segments.empty() && segments.back().i == segment.i
+				&& segments.back().j == segment.j && segments.back().k == segment.k)
+			segments.back().length += pieceLength;
+		else
+			segments.push_back(segment);
+	}
+}
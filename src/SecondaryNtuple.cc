@@ -0,0 +1,195 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "SecondaryNtuple.hh"
+#include "Analysis.hh"
+
+// Geant4 Headers
+#include "G4AutoLock.hh"
+#include "G4Track.hh"
+#include "G4VProcess.hh"
+
+// C++ Headers
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+G4int SecondaryNtuple::sampleEvery = 1;
+G4int SecondaryNtuple::firstNtupleId = 0;
+
+namespace
+{
+	G4Mutex dictionaryMutex = G4MUTEX_INITIALIZER;
+
+	// Code to name table, shared by all the threads
+	struct Dictionary
+	{
+		std::vector<G4String> names;
+		std::unordered_map<std::string, G4int> codes;
+
+		G4int Encode(const G4String& name)
+		{
+			G4AutoLock lock(&dictionaryMutex);
+			std::unordered_map<std::string, G4int>::const_iterator it = codes.find(name);
+			if (it != codes.end()) return it->second;
+			G4int code = names.size();
+			names.push_back(name);
+			codes[name] = code;
+			return code;
+		}
+	};
+
+	Dictionary processes, models, particles;
+
+	// Accepted codes (empty: everything)
+	std::set<G4int> particleFilter, creatorFilter;
+
+	// Per thread lookups, so a known track costs no string handling nor locking
+	struct Cache
+	{
+		std::unordered_map<const void*, G4int> particles;
+		std::unordered_map<const void*, G4int> processes;
+		std::unordered_map<G4long, G4int> models;
+		G4long tracks;
+	};
+
+	G4ThreadLocal Cache* cache = 0;
+
+	G4int Lookup(std::unordered_map<const void*, G4int>& codes, const void* key,
+			Dictionary& dictionary, const G4String& name)
+	{
+		std::unordered_map<const void*, G4int>::const_iterator it = codes.find(key);
+		if (it != codes.end()) return it->second;
+		return codes[key] = dictionary.Encode(name);
+	}
+
+	void SetFilter(std::set<G4int>& filter, Dictionary& dictionary, const G4String& names)
+	{
+		filter.clear();
+		std::istringstream list(names);
+		G4String name;
+		while (list >> name) filter.insert(dictionary.Encode(name));
+	}
+}
+
+void SecondaryNtuple::Book()
+{
+	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
+
+	G4int id = firstNtupleId = analysisManager->CreateNtuple("SecondariesProduction", "Variables related to secondaries production");
+	analysisManager->SetNtupleActivation(id,true);
+	analysisManager->CreateNtupleDColumn(id,"KineticEnergyAtVertex");
+	analysisManager->CreateNtupleIColumn(id,"CreatorProcess");
+	analysisManager->CreateNtupleIColumn(id,"CreatorModel");
+	analysisManager->CreateNtupleIColumn(id,"Particle");
+	analysisManager->CreateNtupleDColumn(id,"TrackLength");
+	analysisManager->CreateNtupleDColumn(id,"TotalEnergyDeposit");
+	analysisManager->FinishNtuple(id);
+
+	const char* dictionaries[3] = { "Processes", "Models", "Particles" };
+	for (G4int d=0; d<3; d++)
+	{
+		id = analysisManager->CreateNtuple(dictionaries[d], "Code to name table of the SecondariesProduction ntuple");
+		analysisManager->SetNtupleActivation(id,true);
+		analysisManager->CreateNtupleIColumn(id,"Code");
+		analysisManager->CreateNtupleSColumn(id,"Name");
+		analysisManager->FinishNtuple(id);
+	}
+}
+
+void SecondaryNtuple::Fill(const G4Track* aTrack, G4double totalEdep)
+{
+	if (!cache)
+	{
+		cache = new Cache();
+		cache->tracks = 0;
+	}
+
+	G4int particle = Lookup(cache->particles, aTrack->GetParticleDefinition(), particles,
+			aTrack->GetParticleDefinition()->GetParticleName());
+	if (!particleFilter.empty() && !particleFilter.count(particle)) return;
+
+	const G4VProcess* creator = aTrack->GetCreatorProcess();
+	G4int process = Lookup(cache->processes, creator, processes,
+			creator ? creator->GetProcessName() : G4String("gun"));
+	if (!creatorFilter.empty() && !creatorFilter.count(process)) return;
+
+	if (sampleEvery > 1 && (cache->tracks++ % sampleEvery) != 0) return;
+
+	// Tracks without a model are labelled after their process
+	G4int model;
+	G4long modelKey = creator ? (G4long(aTrack->GetCreatorModelID() + 1) << 32 | process) : -1;
+	std::unordered_map<G4long, G4int>::const_iterator it = cache->models.find(modelKey);
+	if (it != cache->models.end()) model = it->second;
+	else
+	{
+		G4String modelName = "gun";
+		if (creator)
+		{
+			modelName = aTrack->GetCreatorModelName();
+			if (modelName == "Undefined") modelName = "u_" + creator->GetProcessName();
+		}
+		model = cache->models[modelKey] = models.Encode(modelName);
+	}
+
+	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
+	analysisManager->FillNtupleDColumn(firstNtupleId,0,aTrack->GetVertexKineticEnergy());
+	analysisManager->FillNtupleIColumn(firstNtupleId,1,process);
+	analysisManager->FillNtupleIColumn(firstNtupleId,2,model);
+	analysisManager->FillNtupleIColumn(firstNtupleId,3,particle);
+	analysisManager->FillNtupleDColumn(firstNtupleId,4,aTrack->GetTrackLength());
+	analysisManager->FillNtupleDColumn(firstNtupleId,5,totalEdep);
+	analysisManager->AddNtupleRow(firstNtupleId);
+}
+
+void SecondaryNtuple::FillDictionaries()
+{
+	G4AutoLock lock(&dictionaryMutex);
+
+	G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
+
+	const Dictionary* dictionaries[3] = { &processes, &models, &particles };
+	for (G4int d=0; d<3; d++)
+	{
+		G4int id = firstNtupleId + 1 + d;
+		for (size_t code=0; code < dictionaries[d]->names.size(); code++)
+		{
+			analysisManager->FillNtupleIColumn(id,0,code);
+			analysisManager->FillNtupleSColumn(id,1,dictionaries[d]->names[code]);
+			analysisManager->AddNtupleRow(id);
+		}
+	}
+}
+
+void SecondaryNtuple::ClearCache()
+{
+	delete cache;
+	cache = 0;
+}
+
+void SecondaryNtuple::SetParticleFilter(const G4String& names)
+{
+	SetFilter(particleFilter, particles, names);
+}
+
+void SecondaryNtuple::SetCreatorFilter(const G4String& names)
+{
+	SetFilter(creatorFilter, processes, names);
+}
@@ -0,0 +1,192 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+
+// PDD1 Headers
+#include "SecondaryYieldScorer.hh"
+#include "DetectorMatrix.hh"
+#include "RunManifest.hh"
+
+// Geant4 Headers
+#include "G4AutoLock.hh"
+#include "G4Threading.hh"
+#include "G4Track.hh"
+#include "G4VProcess.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4SystemOfUnits.hh"
+
+// C++ Headers
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+G4bool SecondaryYieldScorer::enabled = true;
+const G4double SecondaryYieldScorer::kEnergyMin = 1.*eV;
+const G4double SecondaryYieldScorer::kLengthMin = 1.*nm;
+
+G4ThreadLocal SecondaryYieldScorer* SecondaryYieldScorer::instance = NULL;
+std::vector<std::pair<G4int, SecondaryYieldScorer*> > SecondaryYieldScorer::pendingShards;
+
+namespace
+{
+	G4Mutex yieldMutex = G4MUTEX_INITIALIZER;
+}
+
+SecondaryYieldScorer* SecondaryYieldScorer::GetInstance()
+{
+	if (!instance) instance = new SecondaryYieldScorer();
+	return instance;
+}
+
+void SecondaryYieldScorer::DeleteInstance()
+{
+	delete instance;
+	instance = NULL;
+}
+
+SecondaryYieldScorer::SecondaryYieldScorer()
+{}
+
+inline G4int SecondaryYieldScorer::Bin(G4double value, G4double min, G4int decades)
+{
+	if (value < min) return 0;
+	G4int bin = 1 + G4int(std::log10(value/min) * kBinsPerDecade);
+	return std::min(bin, decades * kBinsPerDecade + 1);
+}
+
+void SecondaryYieldScorer::Fill(const G4Track* aTrack)
+{
+	const G4VProcess* creator = aTrack->GetCreatorProcess();
+	Key key = { aTrack->GetParticleDefinition(), creator, creator ? aTrack->GetCreatorModelID() : -1 };
+
+	G4int row;
+	std::unordered_map<Key, G4int, KeyHash>::const_iterator it = fRowCache.find(key);
+	if (it != fRowCache.end()) row = it->second;
+	else
+	{
+		// Same labels as the SecondariesProduction ntuple
+		G4String process = "gun";
+		G4String model = "gun";
+		if (creator)
+		{
+			process = creator->GetProcessName();
+			model = aTrack->GetCreatorModelName();
+			if (model == "Undefined") model = "u_" + process;
+		}
+		row = fRowCache[key] = GetRow(key.particle->GetParticleName(), process, model);
+	}
+
+	G4long* counts = &fRows[row].counts[0];
+	counts[0]++;
+
+	const G4int energyOffset = 1;
+	const G4int lengthOffset = energyOffset + kEnergyDecades * kBinsPerDecade + 2;
+	counts[energyOffset + Bin(aTrack->GetVertexKineticEnergy(), kEnergyMin, kEnergyDecades)]++;
+	counts[lengthOffset + Bin(aTrack->GetTrackLength(), kLengthMin, kLengthDecades)]++;
+}
+
+G4int SecondaryYieldScorer::GetRow(const G4String& particle, const G4String& process, const G4String& model)
+{
+	G4String label = particle + "\t" + process + "\t" + model;
+	std::map<G4String, G4int>::const_iterator it = fRowIndex.find(label);
+	if (it != fRowIndex.end()) return it->second;
+
+	Row newRow = { particle, process, model, std::vector<G4long>(NumberOfCounts(), 0) };
+	fRows.push_back(newRow);
+	return fRowIndex[label] = fRows.size() - 1;
+}
+
+// Queue this worker scorer; the master merges it in EndOfRunAction
+void SecondaryYieldScorer::ScheduleMerge()
+{
+	G4AutoLock lock(&yieldMutex);
+	pendingShards.push_back(std::make_pair(G4Threading::G4GetThreadId(), this));
+}
+
+void SecondaryYieldScorer::MergeShards()
+{
+	G4AutoLock lock(&yieldMutex);
+
+	std::sort(pendingShards.begin(), pendingShards.end());
+
+	for (size_t s=0; s<pendingShards.size(); s++)
+	{
+		SecondaryYieldScorer* shard = pendingShards[s].second;
+		if (shard == this) continue;
+		Merge(shard);
+		shard -> Clear();
+	}
+	pendingShards.clear();
+}
+
+void SecondaryYieldScorer::Merge(const SecondaryYieldScorer* other)
+{
+	for (size_t r=0; r < other->fRows.size(); r++)
+	{
+		const Row& src = other->fRows[r];
+		G4int row = GetRow(src.particle, src.process, src.model);
+		for (size_t n=0; n < src.counts.size(); n++) fRows[row].counts[n] += src.counts[n];
+	}
+}
+
+// Counts are reset, the rows (and the cache pointing at them) are kept
+void SecondaryYieldScorer::Clear()
+{
+	for (size_t r=0; r < fRows.size(); r++)
+		std::fill(fRows[r].counts.begin(), fRows[r].counts.end(), 0);
+}
+
+// Text table, one line per (particle, process, model) in label order:
+// particle, process, model, tracks, then the energy and the length bins,
+// each with an underflow and an overflow bin. Counts are not normalised per event
+void SecondaryYieldScorer::Store(G4int runID, G4long nEvents) const
+{
+	G4String filename = DetectorMatrix::RunFilename(runID, "SecondaryYields", ".out");
+
+	std::ofstream out(filename);
+	if (!out)
+	{
+		G4Exception("SecondaryYieldScorer::Store()", "PDD1002", JustWarning,
+				("Cannot open " + filename).c_str());
+		return;
+	}
+
+	out << "# events " << nEvents << "\n";
+	out << "# KineticEnergyAtVertex: " << kBinsPerDecade << " bins per decade from "
+			<< kEnergyMin/MeV << " MeV to " << kEnergyMin/MeV * std::pow(10., kEnergyDecades) << " MeV\n";
+	out << "# TrackLength: " << kBinsPerDecade << " bins per decade from "
+			<< kLengthMin/mm << " mm to " << kLengthMin/mm * std::pow(10., kLengthDecades) << " mm\n";
+	out << "particle\tprocess\tmodel\ttracks";
+	out << "\tE_under";
+	for (G4int b=0; b < kEnergyDecades * kBinsPerDecade; b++) out << "\tE_" << b;
+	out << "\tE_over\tL_under";
+	for (G4int b=0; b < kLengthDecades * kBinsPerDecade; b++) out << "\tL_" << b;
+	out << "\tL_over\n";
+
+	for (std::map<G4String, G4int>::const_iterator it = fRowIndex.begin(); it != fRowIndex.end(); ++it)
+	{
+		const Row& row = fRows[it->second];
+		if (row.counts[0] == 0) continue;
+
+		out << it->first;
+		for (size_t n=0; n < row.counts.size(); n++) out << '\t' << row.counts[n];
+		out << '\n';
+	}
+
+	out.close();
+	if (!out.fail()) RunManifest::AddOutput(runID, filename);
+}
@@ -0,0 +1,159 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "StoppingPowerTable.hh"
+
+// Geant4 Headers
+#include "G4ParticleDefinition.hh"
+#include "G4Material.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4UnitsTable.hh"
+
+// C++ Headers
+#include <cmath>
+
+G4int StoppingPowerTable::verifyEvery = 0;
+
+namespace
+{
+// Energy grid: 50 points per decade from 100 eV to 100 GeV
+const G4double kEmin = 100*eV;
+const G4double kEmax = 100*GeV;
+const G4int kBinsPerDecade = 50;
+const G4double kLogEmin = std::log(kEmin);
+const G4double kBinsPerLogE = kBinsPerDecade/std::log(10.);
+const G4int kNPoints = G4int(std::log10(kEmax/kEmin)*kBinsPerDecade + 0.5) + 1;
+}
+
+StoppingPowerTable::StoppingPowerTable()
+: fLastKey(0, 0),
+  fLastTable(0),
+  fNLookups(0),
+  fNVerified(0),
+  fMaxRelError(0.),
+  fMaxErrorEnergy(0.)
+{}
+
+StoppingPowerTable::~StoppingPowerTable()
+{}
+
+void StoppingPowerTable::Clear()
+{
+	fTables.clear();
+	fLastKey = Key(0, 0);
+	fLastTable = 0;
+}
+
+G4double StoppingPowerTable::GetElectronicDEDX(G4double kinE, const G4ParticleDefinition* particleDef, const G4Material* mat)
+{
+	G4double dedx;
+
+	if (kinE <= kEmin || kinE >= kEmax)
+	{
+		// Out of the tabulated range: ask G4EmCalculator
+		dedx = fCalculator.ComputeElectronicDEDX(kinE, particleDef, mat);
+	}
+	else
+	{
+		const std::vector<G4double>& table = GetTable(particleDef, mat);
+
+		// Linear interpolation in log(E)
+		G4double x = (std::log(kinE) - kLogEmin) * kBinsPerLogE;
+		G4int bin = std::min(G4int(x), kNPoints - 2);
+		G4double f = x - bin;
+		dedx = table[bin] + f * (table[bin + 1] - table[bin]);
+	}
+
+	if (verifyEvery > 0 && (fNLookups++) % verifyEvery == 0) Verify(kinE, dedx, particleDef, mat);
+
+	return dedx;
+}
+
+const std::vector<G4double>& StoppingPowerTable::GetTable(const G4ParticleDefinition* particleDef, const G4Material* mat)
+{
+	Key key(particleDef, mat);
+	if (fLastTable && key == fLastKey) return *fLastTable;
+
+	std::vector<G4double>& table = fTables[key];
+	if (table.empty())
+	{
+		table.resize(kNPoints);
+		for (G4int n=0; n<kNPoints; n++)
+		{
+			G4double energy = std::exp(kLogEmin + n / kBinsPerLogE);
+			table[n] = fCalculator.ComputeElectronicDEDX(energy, particleDef, mat);
+		}
+	}
+
+	fLastKey = key;
+	fLastTable = &table;
+	return table;
+}
+
+void StoppingPowerTable::Verify(G4double kinE, G4double dedx, const G4ParticleDefinition* particleDef, const G4Material* mat)
+{
+	G4double exact = fCalculator.ComputeElectronicDEDX(kinE, particleDef, mat);
+	fNVerified++;
+
+	if (exact <= 0.) return;
+
+	G4double relError = std::abs(dedx - exact)/exact;
+	if (relError > fMaxRelError)
+	{
+		fMaxRelError = relError;
+		fMaxErrorEnergy = kinE;
+		fMaxErrorParticle = particleDef -> GetParticleName();
+		fMaxErrorMaterial = mat -> GetName();
+	}
+}
+
+void StoppingPowerTable::MergeVerification(const StoppingPowerTable& other)
+{
+	fNLookups += other.fNLookups;
+	fNVerified += other.fNVerified;
+	if (other.fMaxRelError > fMaxRelError)
+	{
+		fMaxRelError = other.fMaxRelError;
+		fMaxErrorEnergy = other.fMaxErrorEnergy;
+		fMaxErrorParticle = other.fMaxErrorParticle;
+		fMaxErrorMaterial = other.fMaxErrorMaterial;
+	}
+}
+
+void StoppingPowerTable::ResetVerification()
+{
+	fNLookups = 0;
+	fNVerified = 0;
+	fMaxRelError = 0.;
+	fMaxErrorEnergy = 0.;
+	fMaxErrorParticle = "";
+	fMaxErrorMaterial = "";
+}
+
+void StoppingPowerTable::PrintVerification() const
+{
+	G4cout << "StoppingPowerTable: " << fNVerified << " of " << fNLookups
+			<< " lookups checked against G4EmCalculator, max relative error "
+			<< fMaxRelError;
+	if (fNVerified && fMaxRelError > 0.)
+	{
+		G4cout << " (" << fMaxErrorParticle << " in " << fMaxErrorMaterial
+				<< " at " << G4BestUnit(fMaxErrorEnergy, "Energy") << ")";
+	}
+	G4cout << G4endl;
+}
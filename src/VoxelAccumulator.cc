@@ -0,0 +1,175 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "VoxelAccumulator.hh"
+
+// C++ Headers
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+
+VoxelAccumulator::VoxelAccumulator(G4int nX, G4int nY, G4int nZ, Storage storage, Layout layout)
+: fNX(nX),
+  fNY(nY),
+  fNZ(nZ),
+  fNVoxel(size_t(nX) * nY * nZ),
+  fStorage(storage),
+  fLayout(layout),
+  fData(0),
+  fTX(0),
+  fTY(0),
+  fTZ(0),
+  fNTiles(0)
+{
+	if (fStorage == kDense)
+	{
+		fData = new G4double[kNQuantities * fNVoxel]();
+	}
+	else
+	{
+		fTX = (fNX + kTileMask) >> kTileBits;
+		fTY = (fNY + kTileMask) >> kTileBits;
+		fTZ = (fNZ + kTileMask) >> kTileBits;
+		fTiles.assign(size_t(fTX) * fTY * fTZ, (G4double*) 0);
+	}
+}
+
+VoxelAccumulator::~VoxelAccumulator()
+{
+	delete[] fData;
+	for (size_t t=0; t<fTiles.size(); t++) delete[] fTiles[t];
+}
+
+G4double* VoxelAccumulator::NewTile()
+{
+	fNTiles++;
+	return new G4double[kNQuantities * kTileSize]();
+}
+
+void VoxelAccumulator::Merge(const VoxelAccumulator& other)
+{
+	G4bool sameLayout = (fLayout == other.fLayout);
+
+	if (sameLayout && fStorage == kDense && other.fStorage == kDense)
+	{
+		for (size_t n=0; n<kNQuantities * fNVoxel; n++) fData[n] += other.fData[n];
+		return;
+	}
+
+	if (sameLayout && fStorage == kSparse && other.fStorage == kSparse)
+	{
+		for (size_t t=0; t<fTiles.size(); t++)
+		{
+			const G4double* src = other.fTiles[t];
+			if (!src) continue;
+			if (!fTiles[t]) fTiles[t] = NewTile();
+			G4double* dst = fTiles[t];
+			for (G4int n=0; n<kNQuantities * kTileSize; n++) dst[n] += src[n];
+		}
+		return;
+	}
+
+	// Mixed storage or layout: go voxel by voxel, skipping empty values
+	for (G4int q=0; q<kNQuantities; q++)
+		for(G4int i = 0; i < fNX; i++)
+			for(G4int j = 0; j < fNY; j++)
+				for(G4int k = 0; k < fNZ; k++)
+				{
+					G4double value = other.Get(Quantity(q), i, j, k);
+					if (value != 0.) Add(Quantity(q), i, j, k, value);
+				}
+}
+
+G4double VoxelAccumulator::Total(Quantity q) const
+{
+	G4double total = 0.;
+
+	if (fStorage == kDense)
+	{
+		for (size_t v=0; v<fNVoxel; v++) total += fData[Offset(q, v, fNVoxel)];
+		return total;
+	}
+
+	// Voxels of the edge tiles outside the grid are never filled
+	for (size_t t=0; t<fTiles.size(); t++)
+	{
+		const G4double* tile = fTiles[t];
+		if (!tile) continue;
+		for (G4int v=0; v<kTileSize; v++) total += tile[Offset(q, v, kTileSize)];
+	}
+	return total;
+}
+
+void VoxelAccumulator::Write(std::ostream& out) const
+{
+	// Count the non-empty voxels first, so the dump can be read in one pass
+	uint64_t count = 0;
+	ForEachVoxel([&count](size_t, const G4double*) { count++; });
+
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	ForEachVoxel([&out](size_t v, const G4double* values)
+	{
+		uint32_t voxel = v;
+		out.write(reinterpret_cast<const char*>(&voxel), sizeof(voxel));
+		out.write(reinterpret_cast<const char*>(values), kNQuantities * sizeof(G4double));
+	});
+}
+
+G4bool VoxelAccumulator::Read(std::istream& in)
+{
+	uint64_t count = 0;
+	if (!in.read(reinterpret_cast<char*>(&count), sizeof(count))) return false;
+	if (count > fNVoxel) return false;
+
+	// Read and check all the records before adding any of them
+	const size_t recordSize = sizeof(uint32_t) + kNQuantities * sizeof(G4double);
+	std::vector<char> records(count * recordSize);
+	if (count && !in.read(records.data(), records.size())) return false;
+
+	for (uint64_t n=0; n<count; n++)
+	{
+		uint32_t voxel;
+		std::memcpy(&voxel, &records[n * recordSize], sizeof(voxel));
+		if (voxel >= fNVoxel) return false;
+	}
+
+	for (uint64_t n=0; n<count; n++)
+	{
+		uint32_t voxel;
+		G4double values[kNQuantities];
+		std::memcpy(&voxel, &records[n * recordSize], sizeof(voxel));
+		std::memcpy(values, &records[n * recordSize + sizeof(voxel)], sizeof(values));
+
+		G4int k = voxel % fNZ;
+		G4int j = (voxel / fNZ) % fNY;
+		G4int i = voxel / (size_t(fNZ) * fNY);
+		for (G4int q=0; q<kNQuantities; q++)
+			if (values[q] != 0.) Add(Quantity(q), i, j, k, values[q]);
+	}
+
+	return true;
+}
+
+size_t VoxelAccumulator::GetMemoryUsage() const
+{
+	if (fStorage == kDense) return kNQuantities * fNVoxel * sizeof(G4double);
+
+	return fTiles.size() * sizeof(G4double*) + fNTiles * kNQuantities * kTileSize * sizeof(G4double);
+}
@@ -0,0 +1,200 @@
+/*
+ * PDD 1.0
+ * Copyright (c) 2020
+ * Universidad Nacional de Colombia
+ * Servicio Geológico Colombiano
+ * All Right Reserved.
+ *
+ * Developed by Andrés Camilo Sevilla Moreno
+ *
+ * Use and copying of these libraries and preparation of derivative works
+ * based upon these libraries are permitted. Any copy of these libraries
+ * must include this copyright notice.
+ *
+ * Bogotá, Colombia.
+ *
+ */
+
+// PDD1 Headers
+#include "VoxelPhantom.hh"
+#include "Materials.hh"
+
+// Geant4 Headers
+#include "G4Material.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+// C++ Headers
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+G4double VoxelPhantom::densityStep = 0.01*g/cm3;
+
+VoxelPhantom::VoxelPhantom()
+: fNX(0),
+  fNY(0),
+  fNZ(0)
+{}
+
+VoxelPhantom::~VoxelPhantom()
+{}
+
+G4bool VoxelPhantom::Load(const G4String& mapFilename, const G4String& tableFilename)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<LookupRow> table;
+	if (!ReadTable(tableFilename, table)) return false;
+
+	std::ifstream in(mapFilename, std::ios::in | std::ios::binary);
+	if (!in)
+	{
+		G4Exception("VoxelPhantom::Load()", "PDD1003", JustWarning,
+				("Cannot open " + mapFilename).c_str());
+		return false;
+	}
+
+	char magic[6];
+	uint16_t version, kind;
+	int32_t shape[3];
+	G4double voxelSize[3];
+	G4double intercept;
+
+	G4bool valid = in.read(magic, sizeof(magic)) && std::string(magic, sizeof(magic)) == "PDDVOX"
+			&& in.read(reinterpret_cast<char*>(&version), sizeof(version)) && version == 1
+			&& in.read(reinterpret_cast<char*>(shape), sizeof(shape))
+			&& in.read(reinterpret_cast<char*>(voxelSize), sizeof(voxelSize))
+			&& in.read(reinterpret_cast<char*>(&kind), sizeof(kind))
+			&& in.read(reinterpret_cast<char*>(&intercept), sizeof(intercept))
+			&& shape[0] > 0 && shape[1] > 0 && shape[2] > 0 && kind <= kMaterialIndex
+			&& voxelSize[0] > 0. && voxelSize[1] > 0. && voxelSize[2] > 0.;
+
+	// The values are read in place, then turned into material indices
+	size_t nVoxels = valid ? size_t(shape[0]) * shape[1] * shape[2] : 0;
+	if (valid)
+	{
+		fIndices.resize(nVoxels);
+		valid = bool(in.read(reinterpret_cast<char*>(&fIndices[0]), nVoxels * sizeof(uint16_t)));
+	}
+
+	if (!valid)
+	{
+		fIndices.clear();
+		G4Exception("VoxelPhantom::Load()", "PDD1003", JustWarning,
+				(mapFilename + " is not a PDDVOX voxel map or it is truncated").c_str());
+		return false;
+	}
+
+	// Every value present in the map is looked up once, so there are at most
+	// 65536 materials and their indices fit in the map values
+	std::vector<G4int> indexOfValue(65536, -1);
+	for (size_t v=0; v<nVoxels; v++) indexOfValue[fIndices[v]] = 0;
+
+	fMaterials.clear();
+	fMaterialIndex.clear();
+	for (G4int value=0; value<65536; value++)
+	{
+		if (indexOfValue[value] < 0) continue;
+
+		G4double x = (kind == kHounsfield) ? value + intercept : value;
+		const LookupRow* row = 0;
+		for (size_t r=0; r<table.size() && !row; r++)
+		{
+			if (table[r].lower <= x && x < table[r].upper) row = &table[r];
+		}
+		if (!row)
+		{
+			std::ostringstream msg;
+			msg << "No row of " << tableFilename << " for the value " << x << " of " << mapFilename;
+			G4Exception("VoxelPhantom::Load()", "PDD1003", JustWarning, msg.str().c_str());
+			fIndices.clear();
+			return false;
+		}
+
+		G4double density = row->densityLower
+				+ (row->densityUpper - row->densityLower) * (x - row->lower) / (row->upper - row->lower);
+		indexOfValue[value] = MaterialIndex(*row, density);
+	}
+
+	for (size_t v=0; v<nVoxels; v++) fIndices[v] = uint16_t(indexOfValue[fIndices[v]]);
+
+	fNX = shape[0];
+	fNY = shape[1];
+	fNZ = shape[2];
+	fVoxelSize = G4ThreeVector(voxelSize[0]*mm, voxelSize[1]*mm, voxelSize[2]*mm);
+
+	G4double seconds = std::chrono::duration<G4double>(std::chrono::steady_clock::now() - start).count();
+	G4cout << "Voxel phantom " << mapFilename << ": " << fNX << " x " << fNY << " x " << fNZ
+			<< " voxels of " << fVoxelSize/mm << " mm, " << fMaterials.size() << " materials, "
+			<< GetMemoryUsage()/1048576. << " MB, loaded in " << seconds << " s" << G4endl;
+
+	return true;
+}
+
+G4bool VoxelPhantom::ReadTable(const G4String& tableFilename, std::vector<LookupRow>& table) const
+{
+	std::ifstream in(tableFilename, std::ios::in);
+	if (!in)
+	{
+		G4Exception("VoxelPhantom::ReadTable()", "PDD1003", JustWarning,
+				("Cannot open " + tableFilename).c_str());
+		return false;
+	}
+
+	std::string line;
+	for (G4int number=1; std::getline(in, line); number++)
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+
+		G4String materialName;
+		LookupRow row;
+		if (!(fields >> row.lower)) continue;
+
+		G4bool valid = bool(fields >> row.upper >> materialName >> row.densityLower >> row.densityUpper)
+				&& row.lower < row.upper && row.densityLower > 0. && row.densityUpper > 0.;
+		row.material = valid ? Materials::GetInstance()->GetMaterial(materialName) : 0;
+		if (!row.material)
+		{
+			std::ostringstream msg;
+			msg << tableFilename << ":" << number << ": expected 'lower upper material densityLower densityUpper'"
+					<< " with a known material";
+			G4Exception("VoxelPhantom::ReadTable()", "PDD1003", JustWarning, msg.str().c_str());
+			return false;
+		}
+
+		row.densityLower *= g/cm3;
+		row.densityUpper *= g/cm3;
+		table.push_back(row);
+	}
+
+	return !table.empty();
+}
+
+uint16_t VoxelPhantom::MaterialIndex(const LookupRow& row, G4double density)
+{
+	// Round the density, the base material is used when it already has it
+	G4long step = G4long(density / densityStep + 0.5);
+	if (step < 1) step = 1;
+	G4double roundedDensity = step * densityStep;
+
+	G4Material* material = row.material;
+	if (std::fabs(roundedDensity - material->GetDensity()) >= 0.5 * densityStep)
+	{
+		std::ostringstream name;
+		name << row.material->GetName() << "_" << G4long(roundedDensity / (mg/cm3) + 0.5) << "mgcm3";
+
+		material = G4Material::GetMaterial(name.str(), false);
+		if (!material) material = new G4Material(name.str(), roundedDensity, row.material);
+	}
+
+	std::map<G4String, uint16_t>::const_iterator found = fMaterialIndex.find(material->GetName());
+	if (found != fMaterialIndex.end()) return found->second;
+
+	uint16_t index = uint16_t(fMaterials.size());
+	fMaterialIndex[material->GetName()] = index;
+	fMaterials.push_back(material);
+	return index;
+}